@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""Asset pack builder
+
+Bundles several files into a single indexed asset pack, meant to be placed on
+the disc alongside the executable and loaded on demand through the ISO9660
+reader rather than being embedded into the executable. The pack starts with a
+header and table of contents, which always fit within the first sector, followed
+by the files themselves; each file is compressed with the same format used by
+compressAsset.py (and can thus be unpacked using asset_unpack()) and starts on a
+sector boundary, so that it can be read directly without any seeking.
+
+Requires no external dependencies.
+"""
+
+__version__ = "0.1.0"
+
+import logging
+from argparse import ArgumentParser, FileType, Namespace
+from pathlib  import Path
+from struct   import Struct
+
+from compressAsset import packAsset
+
+## Main
+
+PACK_HEADER_STRUCT: Struct = Struct("< 4s 2H")
+PACK_HEADER_MAGIC:  bytes  = b"PPAK"
+PACK_VERSION:       int    = 1
+PACK_ENTRY_STRUCT:  Struct = Struct("< 16s 2I")
+PACK_NAME_LENGTH:   int    = 16
+SECTOR_SIZE:        int    = 2048
+
+def createParser() -> ArgumentParser:
+	parser = ArgumentParser(
+		description = \
+			"Bundles multiple files into an indexed asset pack to be loaded "
+			"from the disc at runtime.",
+		add_help    = False
+	)
+
+	group = parser.add_argument_group("Tool options")
+	group.add_argument(
+		"-h", "--help",
+		action = "help",
+		help   = "Show this help message and exit"
+	)
+
+	group = parser.add_argument_group("Compression options")
+	group.add_argument(
+		"-s", "--store",
+		action = "store_true",
+		help   = "Store all files uncompressed"
+	)
+
+	group = parser.add_argument_group("File paths")
+	group.add_argument(
+		"output",
+		type = FileType("wb"),
+		help = "Path to asset pack to generate"
+	)
+	group.add_argument(
+		"input",
+		type  = str,
+		nargs = "+",
+		help  = \
+			"Files to add, optionally prefixed with the name to store them "
+			"under (name=path)"
+	)
+
+	return parser
+
+def main():
+	parser: ArgumentParser = createParser()
+	args:   Namespace      = parser.parse_args()
+
+	logging.basicConfig(
+		format = "{levelname}: {message}",
+		style  = "{",
+		level  = logging.INFO
+	)
+
+	tocLength: int = \
+		PACK_HEADER_STRUCT.size + PACK_ENTRY_STRUCT.size * len(args.input)
+
+	if tocLength > SECTOR_SIZE:
+		parser.error("too many files, table of contents exceeds one sector")
+
+	toc:   bytearray = bytearray(
+		PACK_HEADER_STRUCT.pack(PACK_HEADER_MAGIC, PACK_VERSION, len(args.input))
+	)
+	data:  bytearray = bytearray(SECTOR_SIZE)
+	names: set[str]  = set()
+
+	for entry in args.input:
+		name, _, path = entry.rpartition("=")
+		name          = name or Path(path).stem
+
+		if len(name) >= PACK_NAME_LENGTH:
+			parser.error(f"name too long: {name}")
+		if name in names:
+			parser.error(f"duplicate name: {name}")
+
+		names.add(name)
+
+		with open(path, "rb") as _file:
+			blob: bytearray = packAsset(_file.read(), not args.store)
+
+		toc.extend(PACK_ENTRY_STRUCT.pack(
+			name.encode("ascii"),
+			len(data),
+			len(blob)
+		))
+
+		data.extend(blob)
+		data.extend(b"\0" * (-len(data) % SECTOR_SIZE))
+
+		logging.info(f"{name}: {len(blob)} bytes")
+
+	data[0:len(toc)] = toc
+
+	with args.output as _file:
+		_file.write(data)
+
+	logging.info(f"packed {len(args.input)} files, {len(data)} bytes")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""PlayStation 1 texture atlas builder
+
+Packs several images into a single 4bpp or 8bpp indexed color texture that fits
+within one texture page, so that they can be uploaded to VRAM with a single
+transfer and drawn without switching texpage. The palettes of all images are
+merged into a single shared CLUT when possible, or otherwise stacked; either way
+they are stored in extra rows below the image data and uploaded along with it.
+
+A C header listing the VRAM location and UV coordinates of each image (as
+TextureInfo initializers) is generated alongside the raw texture data, plus an
+optional JSON layout file for use by other build steps. Requires PIL/Pillow and
+NumPy to be installed.
+"""
+
+__version__ = "0.1.0"
+
+import json, logging
+from argparse    import ArgumentParser, FileType, Namespace
+from dataclasses import dataclass, field
+from pathlib     import Path
+
+import numpy
+from numpy import ndarray
+from PIL   import Image
+
+from convertImage import BLACK_COLOR, TRANSPARENT_COLOR, convertRGBAto16
+
+## Image loading
+
+@dataclass
+class AtlasImage:
+	name:   str
+	pixels: ndarray   # 2D array of palette indices
+	colors: list[int] # 16bpp palette used by the image
+
+	u:    int = 0
+	v:    int = 0
+	clut: int = 0
+
+	@property
+	def width(self) -> int:
+		return self.pixels.shape[1]
+
+	@property
+	def height(self) -> int:
+		return self.pixels.shape[0]
+
+def loadImage(name: str, path: str, numColors: int) -> AtlasImage:
+	with Image.open(path) as inputImage:
+		inputImage.load()
+
+		if inputImage.mode == "P":
+			image: Image.Image = inputImage.copy()
+		else:
+			image: Image.Image = inputImage.convert("RGBA").quantize(
+				numColors, dither = Image.NONE
+			)
+
+	colorDepth: int   = { "RGB": 3, "RGBA": 4 }[image.palette.mode]
+	clutData:   bytes = image.palette.tobytes()
+
+	palette: ndarray = convertRGBAto16(
+		numpy.frombuffer(clutData, "B").reshape((
+			1, len(clutData) // colorDepth, colorDepth
+		)),
+		TRANSPARENT_COLOR, BLACK_COLOR
+	)[0]
+	pixels: ndarray = numpy.asarray(image, "B")
+
+	# Drop any palette entries that are not actually used by the image (as well
+	# as duplicates), so the remaining ones can be shared with other images if
+	# possible.
+	colors: list[int] = []
+	remap:  ndarray   = numpy.zeros(256, "B")
+
+	for index in sorted(set(pixels.flatten().tolist())):
+		color: int = int(palette[index])
+
+		if color not in colors:
+			colors.append(color)
+
+		remap[index] = colors.index(color)
+
+	if len(colors) > numColors:
+		raise RuntimeError(
+			f"{name}: too many colors ({len(colors)} > {numColors})"
+		)
+
+	return AtlasImage(name, remap[pixels], colors)
+
+## Palette merging and packing
+
+def mergePalettes(images: list[AtlasImage], numColors: int) -> list[list[int]]:
+	shared: list[int] = []
+
+	for image in images:
+		for color in image.colors:
+			if color not in shared:
+				shared.append(color)
+
+	# If all images fit in a single palette, remap them to use it. Otherwise
+	# give each image its own palette.
+	if len(shared) <= numColors:
+		for image in images:
+			remap: ndarray = numpy.array(
+				[ shared.index(color) for color in image.colors ], "B"
+			)
+
+			image.pixels = remap[image.pixels]
+			image.colors = shared
+			image.clut   = 0
+
+		logging.info(f"using a single shared palette ({len(shared)} colors)")
+		return [ shared ]
+
+	for index, image in enumerate(images):
+		image.clut = index
+
+	logging.info(f"using {len(images)} stacked palettes")
+	return [ image.colors for image in images ]
+
+def packImages(images: list[AtlasImage], width: int) -> int:
+	# Simple shelf packer: place images left to right in order of decreasing
+	# height, starting a new shelf whenever the current one is full.
+	x:           int = 0
+	y:           int = 0
+	shelfHeight: int = 0
+
+	for image in sorted(images, key = lambda image: -image.height):
+		if (x + image.width) > width:
+			x            = 0
+			y           += shelfHeight
+			shelfHeight  = 0
+
+		image.u      = x
+		image.v      = y
+		x           += image.width
+		shelfHeight  = max(shelfHeight, image.height)
+
+	return y + shelfHeight
+
+## Main
+
+DMA_CHUNK_SIZE: int = 16 # Must match DMA_MAX_CHUNK_SIZE in gpu.h
+
+def createParser() -> ArgumentParser:
+	parser = ArgumentParser(
+		description = \
+			"Packs multiple images into a single indexed color texture atlas "
+			"and generates a C header with the location of each image.",
+		add_help    = False
+	)
+
+	group = parser.add_argument_group("Tool options")
+	group.add_argument(
+		"-h", "--help",
+		action = "help",
+		help   = "Show this help message and exit"
+	)
+
+	group = parser.add_argument_group("Conversion options")
+	group.add_argument(
+		"-b", "--bpp",
+		type    = int,
+		choices = ( 4, 8 ),
+		default = 4,
+		help    = "Use specified color depth (4/8bpp, default 4bpp)",
+		metavar = "4|8"
+	)
+	group.add_argument(
+		"-x", "--vram-x",
+		type    = int,
+		default = 640,
+		help    = \
+			"X coordinate of the atlas in VRAM, must be a multiple of 16 "
+			"(default 640)",
+		metavar = "value"
+	)
+	group.add_argument(
+		"-y", "--vram-y",
+		type    = int,
+		default = 0,
+		help    = "Y coordinate of the atlas in VRAM (default 0)",
+		metavar = "value"
+	)
+	group.add_argument(
+		"-l", "--layout",
+		type    = FileType("wt"),
+		help    = "Also save the atlas layout to a JSON file",
+		metavar = "file"
+	)
+
+	group = parser.add_argument_group("File paths")
+	group.add_argument(
+		"imageOutput",
+		type = FileType("wb"),
+		help = "Path to raw texture data file to generate"
+	)
+	group.add_argument(
+		"headerOutput",
+		type = FileType("wt"),
+		help = "Path to C header to generate"
+	)
+	group.add_argument(
+		"input",
+		type  = str,
+		nargs = "+",
+		help  = \
+			"Images to pack, optionally prefixed with a name to use in the "
+			"header (name=path)"
+	)
+
+	return parser
+
+def main():
+	parser: ArgumentParser = createParser()
+	args:   Namespace      = parser.parse_args()
+
+	logging.basicConfig(
+		format = "{levelname}: {message}",
+		style  = "{",
+		level  = logging.INFO
+	)
+
+	numColors:    int = 2 ** args.bpp
+	pixelsPerHW:  int = 16 // args.bpp
+	pageWidth:    int = 64 * pixelsPerHW
+
+	if args.vram_x % 16:
+		parser.error("VRAM X coordinate must be a multiple of 16")
+
+	images: list[AtlasImage] = []
+
+	for entry in args.input:
+		name, _, path = entry.rpartition("=")
+
+		try:
+			images.append(loadImage(name or Path(path).stem, path, numColors))
+		except RuntimeError as err:
+			parser.error(err.args[0])
+
+	palettes: list[list[int]] = mergePalettes(images, numColors)
+
+	# Determine the width of the atlas, making sure it's a whole number of
+	# halfwords and is large enough to hold at least one palette per row.
+	width: int = max(
+		max(image.width for image in images),
+		numColors * pixelsPerHW
+	)
+	width = (width + pixelsPerHW - 1) // pixelsPerHW * pixelsPerHW
+
+	imageHeight: int = packImages(images, width)
+
+	# Place the palettes in the rows following the image data.
+	widthHW:      int = width // pixelsPerHW
+	clutsPerRow:  int = widthHW // numColors
+	clutRows:     int = (len(palettes) + clutsPerRow - 1) // clutsPerRow
+	height:       int = imageHeight + clutRows
+
+	# Pad the atlas so its size is a multiple of the DMA chunk size, as
+	# required by sendVRAMData().
+	while ((widthHW * height) % 2) or ((widthHW * height // 2) % DMA_CHUNK_SIZE):
+		height += 1
+
+	u0: int = (args.vram_x % 64) * pixelsPerHW
+	v0: int = args.vram_y % 256
+
+	if (u0 + width) > pageWidth or (v0 + imageHeight) > 256:
+		parser.error("atlas does not fit within a single texture page")
+
+	data: ndarray = numpy.zeros(( height, widthHW ), "<H")
+
+	indices: ndarray = numpy.zeros(( imageHeight, width ), "B")
+	for image in images:
+		indices[
+			image.v:image.v + image.height,
+			image.u:image.u + image.width
+		] = image.pixels
+
+	if args.bpp == 4:
+		indices = indices[:, 0::4] | (indices[:, 1::4] << 4) | \
+			(indices[:, 2::4].astype("<H") << 8) | \
+			(indices[:, 3::4].astype("<H") << 12)
+	else:
+		indices = indices[:, 0::2] | (indices[:, 1::2].astype("<H") << 8)
+
+	data[0:imageHeight, :] = indices
+
+	for index, palette in enumerate(palettes):
+		row:    int = imageHeight + (index // clutsPerRow)
+		column: int = (index % clutsPerRow) * numColors
+
+		data[row, column:column + len(palette)] = palette
+
+	with args.imageOutput as _file:
+		_file.write(data.tobytes())
+
+	# Generate the header and layout file.
+	page: int = 0 \
+		| (((args.vram_x // 64) & 15) <<  0) \
+		| (((args.vram_y // 256) & 1) <<  4) \
+		| ((0                    & 3) <<  5) \
+		| (((args.bpp == 8)      & 3) <<  7) \
+		| (((args.vram_y // 256) & 2) << 10)
+
+	layout: dict = {
+		"x":       args.vram_x,
+		"y":       args.vram_y,
+		"width":   widthHW,
+		"height":  height,
+		"bpp":     args.bpp,
+		"page":    page,
+		"regions": {}
+	}
+	lines: list[str] = [
+		"// Generated by buildAtlas.py from the images listed in",
+		"// CMakeLists.txt, do not edit.",
+		"",
+		"#pragma once",
+		"",
+		f"#define ATLAS_X      {args.vram_x}",
+		f"#define ATLAS_Y      {args.vram_y}",
+		f"#define ATLAS_WIDTH  {widthHW}",
+		f"#define ATLAS_HEIGHT {height}",
+		f"#define ATLAS_PAGE   0x{page:04x}",
+		""
+	]
+
+	for image in images:
+		clutX: int = args.vram_x + (image.clut % clutsPerRow) * numColors
+		clutY: int = args.vram_y + imageHeight + (image.clut // clutsPerRow)
+		clut:  int = ((clutX // 16) & 0x3f) | ((clutY & 0x3ff) << 6)
+
+		u: int = u0 + image.u
+		v: int = v0 + image.v
+
+		layout["regions"][image.name] = {
+			"u":      u,
+			"v":      v,
+			"width":  image.width,
+			"height": image.height,
+			"clut":   clut
+		}
+
+		lines.append(
+			f"#define ATLAS_{image.name.upper()} {{ "
+			f".u = {u}, .v = {v}, "
+			f".width = {image.width}, .height = {image.height}, "
+			f".page = 0x{page:04x}, .clut = 0x{clut:04x} }}"
+		)
+
+	with args.headerOutput as _file:
+		_file.write("\n".join(lines) + "\n")
+
+	if args.layout is not None:
+		with args.layout as _file:
+			json.dump(layout, _file, indent = "\t")
+
+	logging.info(
+		f"packed {len(images)} images into {width}x{imageHeight} atlas "
+		f"({data.nbytes} bytes)"
+	)
+
+if __name__ == "__main__":
+	main()
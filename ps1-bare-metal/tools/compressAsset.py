@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""Asset compression tool
+
+Compresses a file using the LZ4 block format and prepends a small header
+containing the compressed and uncompressed lengths, in the format expected by
+asset_unpack(). The data can optionally be stored uncompressed with the same
+header, in which case it can be used in-place without any copying.
+
+This script does not depend on the lz4 Python package, as the compressor is
+simple enough to implement here and needs no tuning for the small files it is
+used on.
+"""
+
+__version__ = "0.1.0"
+
+import logging
+from argparse import ArgumentParser, FileType, Namespace
+from struct   import Struct
+
+## LZ4 block compressor
+
+MIN_MATCH:     int = 4
+LAST_LITERALS: int = 5  # The last 5 bytes must always be literals
+MF_LIMIT:      int = 12 # The last match must start 12 bytes before the end
+MAX_OFFSET:    int = 0xffff
+
+def _writeLength(output: bytearray, length: int):
+	while length >= 255:
+		output.append(255)
+		length -= 255
+
+	output.append(length)
+
+def _writeSequence(
+	output: bytearray, literals: bytes, offset: int = 0, matchLength: int = 0
+):
+	literalLength: int = len(literals)
+	extraLength:   int = matchLength - MIN_MATCH
+
+	token: int = min(literalLength, 15) << 4
+	if offset:
+		token |= min(extraLength, 15)
+
+	output.append(token)
+	if literalLength >= 15:
+		_writeLength(output, literalLength - 15)
+
+	output.extend(literals)
+
+	if offset:
+		output.extend(offset.to_bytes(2, "little"))
+		if extraLength >= 15:
+			_writeLength(output, extraLength - 15)
+
+def compressLZ4(data: bytes) -> bytearray:
+	output:     bytearray        = bytearray()
+	table:      dict[bytes, int] = {}
+	end:        int              = len(data)
+	matchLimit: int              = end - LAST_LITERALS
+	anchor:     int              = 0
+	pos:        int              = 0
+
+	while pos < (end - MF_LIMIT):
+		key:       bytes = data[pos:pos + MIN_MATCH]
+		candidate: int   = table.get(key, -1)
+		table[key]       = pos
+
+		if (candidate < 0) or ((pos - candidate) > MAX_OFFSET):
+			pos += 1
+			continue
+
+		# Extend the match forwards as far as possible, then backwards into any
+		# pending literals.
+		length: int = MIN_MATCH
+
+		while (
+			((pos + length) < matchLimit) and
+			(data[candidate + length] == data[pos + length])
+		):
+			length += 1
+
+		while (
+			(pos > anchor) and (candidate > 0) and
+			(data[pos - 1] == data[candidate - 1])
+		):
+			pos       -= 1
+			candidate -= 1
+			length    += 1
+
+		_writeSequence(output, data[anchor:pos], pos - candidate, length)
+
+		# Index the positions covered by the match as well, so that later
+		# matches can reference them.
+		for index in range(pos + 1, min(pos + length, end - MIN_MATCH)):
+			table[data[index:index + MIN_MATCH]] = index
+
+		pos   += length
+		anchor = pos
+
+	_writeSequence(output, data[anchor:])
+	return output
+
+## Main
+
+ASSET_HEADER_STRUCT: Struct = Struct("< 2I")
+ASSET_ALIGNMENT:     int    = 4
+
+def packAsset(data: bytes, compress: bool = True) -> bytearray:
+	payload:          bytes = compressLZ4(data) if compress else data
+	compressedLength: int   = len(payload)
+
+	# Fall back to storing the data if compression makes it larger.
+	if compressedLength >= len(data):
+		payload          = data
+		compressedLength = 0
+
+	output: bytearray = bytearray(
+		ASSET_HEADER_STRUCT.pack(len(data), compressedLength)
+	)
+	output.extend(payload)
+
+	while len(output) % ASSET_ALIGNMENT:
+		output.append(0)
+
+	return output
+
+def createParser() -> ArgumentParser:
+	parser = ArgumentParser(
+		description = \
+			"Compresses a file using LZ4 and prepends the header expected by "
+			"asset_unpack().",
+		add_help    = False
+	)
+
+	group = parser.add_argument_group("Tool options")
+	group.add_argument(
+		"-h", "--help",
+		action = "help",
+		help   = "Show this help message and exit"
+	)
+
+	group = parser.add_argument_group("Compression options")
+	group.add_argument(
+		"-s", "--store",
+		action = "store_true",
+		help   = "Store the data uncompressed (only add the header)"
+	)
+
+	group = parser.add_argument_group("File paths")
+	group.add_argument(
+		"input",
+		type = FileType("rb"),
+		help = "Path to file to compress"
+	)
+	group.add_argument(
+		"output",
+		type = FileType("wb"),
+		help = "Path to compressed asset to generate"
+	)
+
+	return parser
+
+def main():
+	parser: ArgumentParser = createParser()
+	args:   Namespace      = parser.parse_args()
+
+	logging.basicConfig(
+		format = "{levelname}: {message}",
+		style  = "{",
+		level  = logging.INFO
+	)
+
+	with args.input as _file:
+		data: bytes = _file.read()
+
+	output: bytearray = packAsset(data, not args.store)
+
+	with args.output as _file:
+		_file.write(output)
+
+	logging.info(
+		f"{args.input.name}: {len(data)} -> {len(output)} bytes "
+		f"({len(output) * 100 // max(len(data), 1)}%)"
+	)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""PlayStation 1 font metrics compiler
+
+Measures each glyph in a font spritesheet and generates a C header containing a
+dense 256-entry glyph table, indexed directly by character code. Each entry
+holds the ready-to-use GP0 UV word (with the CLUT already folded in) and size
+word for a textured rectangle command, plus the horizontal advance, so that the
+text renderer does not have to do any lookup or coordinate math at runtime.
+
+The position of each glyph within the spritesheet is described by a JSON file
+listing rows of equally spaced cells (the last of which may be wider); the width
+of each glyph is then derived from the rightmost non-transparent column within
+its cell, unless the row specifies a fixed width. Individual glyphs whose
+measurements are off (e.g. because their drawing does not fill the cell's full
+height) can be corrected using per-glyph overrides. The final UV coordinates
+and CLUT are taken from the layout file generated by buildAtlas.py. Requires
+PIL/Pillow and NumPy to be installed.
+"""
+
+__version__ = "0.1.0"
+
+import json, logging
+from argparse    import ArgumentParser, FileType, Namespace
+from dataclasses import dataclass
+
+import numpy
+from numpy import ndarray
+from PIL   import Image
+
+from convertImage import LOWER_ALPHA_BOUND
+
+## Glyph measurement
+
+@dataclass
+class Glyph:
+	x:       int
+	y:       int
+	width:   int
+	height:  int
+	advance: int
+
+def measureGlyphs(opaque: ndarray, description: dict) -> dict[int, Glyph]:
+	glyphs:     dict[int, Glyph] = {}
+	imageWidth: int              = opaque.shape[1]
+
+	for row in description["rows"]:
+		y:          int = row["y"]
+		height:     int = row["height"]
+		cellWidth:  int = row["cellWidth"]
+		fixedWidth: int = row.get("width", 0)
+
+		for index in range(row["count"]):
+			char: int = row["first"] + index
+			x:    int = index * cellWidth
+
+			if fixedWidth:
+				width: int = fixedWidth
+			else:
+				# The last cell in a row may optionally be wider than the
+				# others, allowing for an oversized final glyph.
+				if index == (row["count"] - 1):
+					right: int = x + row.get("lastCellWidth", cellWidth)
+				else:
+					right: int = x + cellWidth
+
+				columns: ndarray = numpy.flatnonzero(
+					opaque[y:y + height, x:right].any(axis = 0)
+				)
+				width: int = (int(columns[-1]) + 1) if len(columns) else 0
+
+			if (x + width) > imageWidth:
+				raise RuntimeError(
+					f"glyph 0x{char:02x} extends past the edge of the image"
+				)
+			if char in glyphs:
+				raise RuntimeError(f"glyph 0x{char:02x} defined more than once")
+
+			glyphs[char] = Glyph(x, y, width, height, width)
+
+	# Characters whose cell is empty (i.e. the space) are not drawn at all but
+	# still move the cursor.
+	for glyph in glyphs.values():
+		if not glyph.width:
+			glyph.advance = description["spaceWidth"]
+
+	# Overrides replace any of the measured values. The advance follows the
+	# width unless it is overridden as well.
+	for key, override in description.get("overrides", {}).items():
+		char: int = int(key, 0)
+
+		if char not in glyphs:
+			raise RuntimeError(f"override for undefined glyph 0x{char:02x}")
+
+		glyph: Glyph = glyphs[char]
+
+		for field in override:
+			if field not in ( "x", "y", "width", "height", "advance" ):
+				raise RuntimeError(
+					f"invalid field '{field}' in override for glyph 0x{char:02x}"
+				)
+
+		glyph.x       = override.get("x",       glyph.x)
+		glyph.y       = override.get("y",       glyph.y)
+		glyph.width   = override.get("width",   glyph.width)
+		glyph.height  = override.get("height",  glyph.height)
+		glyph.advance = override.get("advance", glyph.width)
+
+		if (glyph.x + glyph.width) > imageWidth:
+			raise RuntimeError(
+				f"glyph 0x{char:02x} extends past the edge of the image"
+			)
+
+	return glyphs
+
+## Main
+
+def createParser() -> ArgumentParser:
+	parser = ArgumentParser(
+		description = \
+			"Measures the glyphs in a font spritesheet and generates a C header "
+			"with a glyph table for use by the text renderer.",
+		add_help    = False
+	)
+
+	group = parser.add_argument_group("Tool options")
+	group.add_argument(
+		"-h", "--help",
+		action = "help",
+		help   = "Show this help message and exit"
+	)
+
+	group = parser.add_argument_group("Atlas options")
+	group.add_argument(
+		"-r", "--region",
+		type    = str,
+		default = "font",
+		help    = "Name of the font's region in the atlas (default font)",
+		metavar = "name"
+	)
+
+	group = parser.add_argument_group("File paths")
+	group.add_argument(
+		"image",
+		type = str,
+		help = "Path to font spritesheet"
+	)
+	group.add_argument(
+		"description",
+		type = FileType("rt"),
+		help = "Path to JSON file describing the glyph grid"
+	)
+	group.add_argument(
+		"layout",
+		type = FileType("rt"),
+		help = "Path to JSON atlas layout generated by buildAtlas.py"
+	)
+	group.add_argument(
+		"headerOutput",
+		type = FileType("wt"),
+		help = "Path to C header to generate"
+	)
+
+	return parser
+
+def main():
+	parser: ArgumentParser = createParser()
+	args:   Namespace      = parser.parse_args()
+
+	logging.basicConfig(
+		format = "{levelname}: {message}",
+		style  = "{",
+		level  = logging.INFO
+	)
+
+	with args.description as _file:
+		description: dict = json.load(_file)
+	with args.layout as _file:
+		layout: dict = json.load(_file)
+
+	try:
+		region: dict = layout["regions"][args.region]
+	except KeyError:
+		parser.error(f"region '{args.region}' not found in atlas layout")
+
+	with Image.open(args.image) as image:
+		alpha: ndarray = numpy.asarray(image.convert("RGBA"), "B")[:, :, 3]
+
+	if alpha.shape != ( region["height"], region["width"] ):
+		parser.error("font image size does not match its atlas region")
+
+	try:
+		glyphs: dict[int, Glyph] = \
+			measureGlyphs(alpha > LOWER_ALPHA_BOUND, description)
+	except RuntimeError as err:
+		parser.error(err.args[0])
+
+	fallback: int = description["fallback"]
+
+	if not glyphs.get(fallback, Glyph(0, 0, 0, 0, 0)).width:
+		parser.error(f"fallback glyph 0x{fallback:02x} is missing or empty")
+
+	lines: list[str] = [
+		"// Generated by convertFont.py from the font image and its",
+		"// description, do not edit.",
+		"",
+		"#pragma once",
+		"",
+		"#include \"font.h\"",
+		"",
+		f"#define FONT_TAB_WIDTH   {description['tabWidth']}",
+		f"#define FONT_LINE_HEIGHT {description['lineHeight']}",
+		"",
+		"static const FontGlyph fontGlyphs[256] = {"
+	]
+
+	for char in range(256):
+		glyph: Glyph = glyphs.get(char, glyphs[fallback])
+
+		if glyph.width:
+			uv: int = 0 \
+				| ((region["u"] + glyph.x) & 0xff) \
+				| (((region["v"] + glyph.y) & 0xff) << 8) \
+				| ((region["clut"] & 0xffff) << 16)
+			size: int = glyph.width | (glyph.height << 16)
+		else:
+			uv:   int = 0
+			size: int = 0
+
+		# Avoid printing backslashes, which would turn the comment into a
+		# multi-line one.
+		name: str = chr(char) if (0x21 <= char <= 0x7e) else ""
+		name      = name.replace("\\", "")
+
+		lines.append(
+			f"\t{{ 0x{uv:08x}, 0x{size:08x}, {glyph.advance:2d} }}, "
+			f"// 0x{char:02x} {name}".rstrip()
+		)
+
+	lines.append("};")
+
+	with args.headerOutput as _file:
+		_file.write("\n".join(lines) + "\n")
+
+	logging.info(
+		f"measured {len(glyphs)} glyphs, "
+		f"{256 - len(glyphs)} mapped to fallback 0x{fallback:02x}"
+	)
+
+if __name__ == "__main__":
+	main()
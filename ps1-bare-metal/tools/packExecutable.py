@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""Self-decompressing PlayStation 1 .EXE packer
+
+Converts an ELF executable into a PlayStation 1 .EXE file whose contents are
+compressed using LZ4 and unpacked at runtime by a small stub, in order to reduce
+the amount of data that has to be transferred when loading it. The stub is a
+separate position-independent executable (see src/unpacker.s) which is placed
+along with the compressed data right after the end of the unpacked executable;
+once started it decompresses the executable to its original load address and
+jumps to its entry point.
+
+A report listing the original and packed sizes, as well as a rough estimate of
+loading and unpacking times, is printed after packing. Requires no external
+dependencies.
+"""
+
+__version__ = "0.1.0"
+
+import logging
+from argparse import ArgumentParser, FileType, Namespace
+from struct   import Struct
+
+from compressAsset     import compressLZ4
+from convertExecutable import \
+	ELF, EXE_ALIGNMENT, EXE_HEADER_MAGIC, EXE_HEADER_STRUCT, ELFArchitecture, \
+	ELFType, alignToMultiple
+
+## Stub handling
+
+STUB_PARAMS_MAGIC:  bytes  = b"UNPK"
+STUB_PARAMS_STRUCT: Struct = Struct("< 4s 4I")
+STUB_ALIGNMENT:     int    = 16
+
+# The stack is placed by the BIOS at the end of RAM, so make sure the stub does
+# not end up overwriting it.
+RAM_END:       int = 0x801fff00
+STACK_RESERVE: int = 0x10000
+
+def loadStub(path: str) -> tuple[bytearray, int]:
+	with open(path, "rb") as file:
+		stub: ELF = ELF(file)
+
+	startAddress, data = stub.flatten()
+
+	if stub.entryPoint != startAddress:
+		raise RuntimeError("stub entry point must be at its beginning")
+
+	offset: int = data.find(STUB_PARAMS_MAGIC)
+
+	if (offset < 0) or (data.find(STUB_PARAMS_MAGIC, offset + 1) >= 0):
+		raise RuntimeError("unable to locate stub parameters")
+
+	alignToMultiple(data, 4)
+	return data, offset
+
+## Main
+
+# Rough figures used for the report. Unpacking takes about 10 cycles per output
+# byte on a 33.8688 MHz R3000 with the byte-by-byte loops used by the stub.
+SECTOR_SIZE:            int   = 2048
+SECTORS_PER_SECOND:     int   = 75
+CPU_CLOCK:              float = 33868800
+UNPACK_CYCLES_PER_BYTE: int   = 10
+
+def estimateLoadTime(length: int, speed: int) -> float:
+	sectors: int = (length + SECTOR_SIZE - 1) // SECTOR_SIZE
+
+	return sectors / (SECTORS_PER_SECOND * speed)
+
+def createParser() -> ArgumentParser:
+	parser = ArgumentParser(
+		description = \
+			"Converts an ELF executable into a self-decompressing PlayStation 1 "
+			".EXE file.",
+		add_help    = False
+	)
+
+	group = parser.add_argument_group("Tool options")
+	group.add_argument(
+		"-h", "--help",
+		action = "help",
+		help   = "Show this help message and exit"
+	)
+
+	group = parser.add_argument_group("Conversion options")
+	group.add_argument(
+		"-r", "--region-str",
+		type    = str,
+		default = "",
+		help    = "Add a custom region string to the header",
+		metavar = "string"
+	)
+
+	group = parser.add_argument_group("File paths")
+	group.add_argument(
+		"input",
+		type = FileType("rb"),
+		help = "Path to ELF input executable",
+	)
+	group.add_argument(
+		"stub",
+		type = str,
+		help = "Path to ELF decompression stub (built from src/unpacker.s)"
+	)
+	group.add_argument(
+		"output",
+		type = FileType("wb"),
+		help = "Path to PS1 executable to generate"
+	)
+
+	return parser
+
+def main():
+	parser: ArgumentParser = createParser()
+	args:   Namespace      = parser.parse_args()
+
+	logging.basicConfig(
+		format = "{levelname}: {message}",
+		style  = "{",
+		level  = logging.INFO
+	)
+
+	with args.input as file:
+		try:
+			elf: ELF = ELF(file)
+		except RuntimeError as err:
+			parser.error(err.args[0])
+
+	if elf.type != ELFType.EXECUTABLE:
+		parser.error("ELF file must be an executable")
+	if elf.architecture != ELFArchitecture.MIPS:
+		parser.error("ELF architecture must be MIPS")
+	if not elf.segments:
+		parser.error("ELF file must contain at least one segment")
+
+	try:
+		stubData, paramsOffset = loadStub(args.stub)
+	except (OSError, RuntimeError) as err:
+		parser.error(f"{args.stub}: {err}")
+
+	startAddress, data = elf.flatten()
+	compressed: bytearray = compressLZ4(data)
+
+	# Place the stub right after the unpacked executable, so the compressed
+	# data never overlaps the area being written to.
+	stubAddress: int = startAddress + len(data)
+	stubAddress     += (STUB_ALIGNMENT - 1)
+	stubAddress     -= stubAddress % STUB_ALIGNMENT
+
+	stubData[
+		paramsOffset:paramsOffset + STUB_PARAMS_STRUCT.size
+	] = STUB_PARAMS_STRUCT.pack(
+		STUB_PARAMS_MAGIC,
+		elf.entryPoint,
+		startAddress,
+		len(stubData) - paramsOffset,
+		len(compressed)
+	)
+	stubData.extend(compressed)
+	alignToMultiple(stubData, EXE_ALIGNMENT)
+
+	if (stubAddress + len(stubData)) > (RAM_END - STACK_RESERVE):
+		parser.error("packed executable does not fit in RAM")
+
+	region: bytes = args.region_str.strip().encode("ascii")
+	header: bytes = EXE_HEADER_STRUCT.pack(
+		EXE_HEADER_MAGIC, # Magic
+		stubAddress,      # Entry point
+		0,                # Initial global pointer
+		stubAddress,      # Data load address
+		len(stubData),    # Data size
+		0,                # Stack offset
+		0,                # Stack size
+		region            # Region string
+	)
+
+	with args.output as file:
+		file.write(header)
+		file.write(stubData)
+
+	# Print the size and time report.
+	rawLength:    int   = \
+		len(header) + len(data) + (-len(data) % EXE_ALIGNMENT)
+	packedLength: int   = len(header) + len(stubData)
+	unpackTime:   float = len(data) * UNPACK_CYCLES_PER_BYTE / CPU_CLOCK
+
+	logging.info(
+		f"packed {rawLength} -> {packedLength} bytes "
+		f"({packedLength * 100 // rawLength}%), stub at 0x{stubAddress:08x}"
+	)
+	for speed in ( 1, 2 ):
+		logging.info(
+			f"estimated load time at {speed}x: "
+			f"{estimateLoadTime(rawLength, speed) * 1000:.0f} ms raw, "
+			f"{estimateLoadTime(packedLength, speed) * 1000:.0f} ms packed "
+			f"+ ~{unpackTime * 1000:.0f} ms unpacking"
+		)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,76 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "asset.h"
+#include "logging.h"
+#include "lz4.h"
+#include "psxproject/timer.h"
+
+#if DEBUG_ASSET
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+void *asset_unpack(const void *asset, size_t *length) {
+	const AssetHeader *header = (const AssetHeader *) asset;
+	void              *data   = (void *) &header[1];
+
+	if (length)
+		*length = header->length;
+	if (!header->compressedLength)
+		return data;
+
+	// Round the buffer up to a multiple of 4 bytes, as the data is going to be
+	// read by DMA in whole words.
+	void *buffer = malloc((header->length + 3) & ~3);
+
+	if (!buffer)
+		return 0;
+
+#if DEBUG_ASSET
+	uint32_t start = timer_getTicks();
+#endif
+
+	size_t actual = lz4_decompress(
+		buffer, header->length, data, header->compressedLength
+	);
+
+#if DEBUG_ASSET
+	DEBUG_PRINT(
+		"Asset: %d -> %d bytes in %d us\n", header->compressedLength,
+		actual, timer_ticksToMicroseconds(timer_getTicks() - start)
+	);
+#endif
+
+	if (actual != header->length) {
+		free(buffer);
+		return 0;
+	}
+
+	return buffer;
+}
+
+void asset_release(void *data, const void *asset) {
+	const AssetHeader *header = (const AssetHeader *) asset;
+
+	if (data && (data != (void *) &header[1]))
+		free(data);
+}
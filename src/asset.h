@@ -0,0 +1,55 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Header prepended to each embedded asset by compressAsset.py. The payload
+// is either an LZ4 block or, if compressedLength is zero, the raw data.
+typedef struct {
+	uint32_t length, compressedLength;
+} AssetHeader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Returns a pointer to the contents of an embedded asset, decompressing
+ * it into a newly allocated staging buffer if needed. Stored assets are
+ * returned in-place. The pointer must be passed to asset_release() once the
+ * data is no longer needed (e.g. after it has been uploaded to VRAM or SPU
+ * RAM).
+ *
+ * @param asset
+ * @param length Optional pointer to variable to store the asset's length in
+ * @return Pointer to the data, or NULL if decompression failed
+ */
+void *asset_unpack(const void *asset, size_t *length);
+
+/**
+ * @brief Frees the staging buffer returned by asset_unpack(), if any.
+ *
+ * @param data
+ * @param asset
+ */
+void asset_release(void *data, const void *asset);
+
+#ifdef __cplusplus
+}
+#endif
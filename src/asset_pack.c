@@ -0,0 +1,198 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asset.h"
+#include "asset_pack.h"
+#include "logging.h"
+#include "psxproject/cdrom.h"
+#include "psxproject/filesystem.h"
+#include "psxproject/readbatch.h"
+
+#if DEBUG_ASSET
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+#define SECTOR_SIZE 2048
+
+static uint32_t _packLba = 0;
+static uint8_t  _packTOC[SECTOR_SIZE];
+
+bool assetPack_open(const char *filename) {
+	_packLba = getLbaToFile(filename);
+
+	if (!_packLba) {
+		DEBUG_PRINT("Asset pack %s not found\n", filename);
+		return false;
+	}
+
+	const AssetPackHeader *header = (const AssetPackHeader *) _packTOC;
+
+	if (
+		!startCDROMRead(_packLba, _packTOC, 1, SECTOR_SIZE, true, true) ||
+		memcmp(header->magic, "PPAK", sizeof(header->magic)) ||
+		(header->version != 1) ||
+		(
+			(sizeof(AssetPackHeader) + header->numEntries * sizeof(AssetPackEntry))
+			> SECTOR_SIZE
+		)
+	) {
+		DEBUG_PRINT("Asset pack %s is invalid\n", filename);
+		_packLba = 0;
+		return false;
+	}
+
+	DEBUG_PRINT(
+		"Asset pack %s: %d entries at LBA %d\n", filename, header->numEntries,
+		_packLba
+	);
+	return true;
+}
+
+const AssetPackEntry *assetPack_find(const char *name) {
+	if (!_packLba)
+		return 0;
+
+	const AssetPackHeader *header = (const AssetPackHeader *) _packTOC;
+	const AssetPackEntry  *entry  = (const AssetPackEntry *) &header[1];
+
+	for (int i = header->numEntries; i; i--, entry++) {
+		if (!strncmp(entry->name, name, ASSET_PACK_NAME_LENGTH))
+			return entry;
+	}
+
+	return 0;
+}
+
+static size_t _getNumSectors(const AssetPackEntry *entry) {
+	return (entry->length + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+// Decompresses an entry read into the given buffer, which is either freed or
+// reused for the decompressed data if the entry is stored uncompressed.
+static void *_unpackBuffer(uint8_t *buffer, size_t *length) {
+	size_t assetLength;
+	void   *data = asset_unpack(buffer, &assetLength);
+
+	if (data == &buffer[sizeof(AssetHeader)]) {
+		memmove(buffer, data, assetLength);
+		data = buffer;
+	} else {
+		free(buffer);
+	}
+
+	if (data && length)
+		*length = assetLength;
+
+	return data;
+}
+
+void *assetPack_load(const char *name, size_t *length) {
+	const AssetPackEntry *entry = assetPack_find(name);
+
+	if (!entry) {
+		DEBUG_PRINT("Asset %s not found in pack\n", name);
+		return 0;
+	}
+
+	// Read all sectors spanned by the entry in one go.
+	size_t   numSectors = _getNumSectors(entry);
+	uint8_t *buffer     = malloc(numSectors * SECTOR_SIZE);
+
+	if (!buffer)
+		return 0;
+
+	if (!startCDROMRead(
+		_packLba + entry->offset / SECTOR_SIZE,
+		buffer,
+		numSectors,
+		SECTOR_SIZE,
+		true,
+		true
+	)) {
+		DEBUG_PRINT("Failed to read asset %s\n", name);
+		free(buffer);
+		return 0;
+	}
+
+	return _unpackBuffer(buffer, length);
+}
+
+size_t assetPack_loadMultiple(
+	const char *const *names, void **outputs, size_t count
+) {
+	ReadBatch batch;
+	readBatch_init(&batch);
+
+	for (size_t i = 0; i < count; i++) {
+		const AssetPackEntry *entry = assetPack_find(names[i]);
+		outputs[i]                  = 0;
+
+		if (!entry) {
+			DEBUG_PRINT("Asset %s not found in pack\n", names[i]);
+			continue;
+		}
+
+		size_t numSectors = _getNumSectors(entry);
+		outputs[i]        = malloc(numSectors * SECTOR_SIZE);
+
+		if (!outputs[i])
+			continue;
+
+		if (!readBatch_add(
+			&batch, _packLba + entry->offset / SECTOR_SIZE, outputs[i],
+			numSectors
+		)) {
+			free(outputs[i]);
+			outputs[i] = 0;
+		}
+	}
+
+	// The batch only reports whether all reads succeeded, so a single failure
+	// causes all assets to be discarded.
+	bool success = readBatch_run(&batch);
+
+	size_t loaded = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (!outputs[i])
+			continue;
+
+		if (success)
+			outputs[i] = _unpackBuffer(outputs[i], 0);
+		else
+			free(outputs[i]);
+
+		if (!success || !outputs[i]) {
+			outputs[i] = 0;
+			continue;
+		}
+
+		loaded++;
+	}
+
+	if (!success)
+		DEBUG_PRINT("Failed to read %d assets\n", count);
+
+	return loaded;
+}
@@ -0,0 +1,88 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSET_PACK_NAME_LENGTH 16
+
+// Asset packs are generated by buildAssetPack.py. The header and table of
+// contents always fit in the first sector, and each entry's data starts on a
+// sector boundary and is in the format expected by asset_unpack().
+typedef struct {
+	char     magic[4];
+	uint16_t version, numEntries;
+} AssetPackHeader;
+
+typedef struct {
+	char     name[ASSET_PACK_NAME_LENGTH];
+	uint32_t offset, length;
+} AssetPackEntry;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Locates an asset pack in the root directory of the disc and loads its
+ * table of contents. initFilesystem() must have been called beforehand.
+ *
+ * @param filename ISO9660 name of the pack, e.g. "PICO.DAT;1"
+ * @return True if the pack was found and is valid, false otherwise
+ */
+bool assetPack_open(const char *filename);
+
+/**
+ * @brief Returns the table of contents entry for the asset with the given name,
+ * or NULL if the pack does not contain it (or no pack is open).
+ *
+ * @param name
+ */
+const AssetPackEntry *assetPack_find(const char *name);
+
+/**
+ * @brief Reads an asset from the disc and decompresses it if needed. The data
+ * is returned in a newly allocated buffer, which must be released using free()
+ * once no longer needed.
+ *
+ * @param name
+ * @param length Optional pointer to variable to store the asset's length in
+ * @return Pointer to the data, or NULL if the asset could not be loaded
+ */
+void *assetPack_load(const char *name, size_t *length);
+
+/**
+ * @brief Loads several assets at once. All reads are issued together, ordered
+ * by their position on the disc, so that the drive seeks as little as possible
+ * regardless of the order in which the assets are listed. Each asset is
+ * returned in a newly allocated buffer, which must be released using free().
+ *
+ * @param names
+ * @param outputs Array to store pointers to the data in (NULL for each asset
+ * that could not be loaded)
+ * @param count Number of assets, at most READ_BATCH_MAX_REQUESTS
+ * @return Number of assets successfully loaded
+ */
+size_t assetPack_loadMultiple(
+	const char *const *names, void **outputs, size_t count
+);
+
+#ifdef __cplusplus
+}
+#endif
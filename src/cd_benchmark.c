@@ -0,0 +1,266 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cd_benchmark.h"
+#include "ps1/cdrom.h"
+#include "psxproject/cdrom.h"
+#include "psxproject/irq.h"
+#include "psxproject/sectorcache.h"
+#include "psxproject/timer.h"
+
+#define SECTOR_SIZE         2048
+#define LISTING_SECTOR_SIZE 2340
+
+#define FIRST_LBA             16 // Primary volume descriptor
+#define SEQUENTIAL_SECTORS    512
+#define BUFFER_SECTORS        32
+#define NUM_SEEKS             32
+#define NUM_ACKS              32
+#define NUM_LISTINGS          8
+
+const uint16_t cdBenchmarkSeekBuckets[CD_BENCHMARK_SEEK_BUCKETS] = {
+	5, 10, 20, 50, 100, 200, 500, 0xffff // Milliseconds
+};
+
+static void _addSample(CDBenchmarkStat *stat, uint32_t value) {
+	if (!stat->count || (value < stat->min))
+		stat->min = value;
+	if (!stat->count || (value > stat->max))
+		stat->max = value;
+
+	stat->total += value;
+	stat->count++;
+}
+
+static uint32_t _getAverage(const CDBenchmarkStat *stat) {
+	return stat->count ? (stat->total / stat->count) : 0;
+}
+
+static uint32_t _getElapsed(uint32_t start) {
+	return timer_ticksToMicroseconds(timer_getTicks() - start);
+}
+
+static uint32_t _nextRandom(uint32_t *state) {
+	// Plain xorshift32, good enough to scatter reads across the disc.
+	uint32_t value = *state;
+
+	value ^= value << 13;
+	value ^= value >> 17;
+	value ^= value << 5;
+
+	*state = value;
+	return value;
+}
+
+// Returns the number of sectors in the volume, as recorded in the primary
+// volume descriptor.
+static uint32_t _getVolumeLength(uint8_t *buffer) {
+	if (!startCDROMRead(FIRST_LBA, buffer, 1, SECTOR_SIZE, true, true))
+		return 0;
+
+	return 0
+		| (buffer[80] <<  0)
+		| (buffer[81] <<  8)
+		| (buffer[82] << 16)
+		| (buffer[83] << 24);
+}
+
+static uint32_t _benchmarkSequential(
+	CDBenchmarkResults *results, uint8_t *buffer, uint32_t numSectors,
+	bool doubleSpeed
+) {
+	// The whole range is read with a single ReadN command, so that the drive
+	// streams sectors without seeking again. Timing starts once the first
+	// sector has arrived, so that the speed change and initial seek are not
+	// accounted for. The data itself is discarded, hence the small ring
+	// buffer.
+	cdrom_startRingRead(
+		FIRST_LBA, buffer, numSectors, BUFFER_SECTORS, doubleSpeed
+	);
+
+	uint32_t readId    = cdrom_getReadId();
+	size_t   remaining = numSectors;
+	size_t   timed     = 0;
+	uint32_t start     = 0;
+	bool     started   = false;
+	uint32_t deadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+
+	while (remaining) {
+		size_t current = cdrom_getReadRemaining(readId);
+
+		if (current == CDROM_READ_UNKNOWN) {
+			results->errors++;
+			return 0;
+		}
+
+		if (current != remaining) {
+			// Only the sectors still to come once the first one has arrived
+			// are timed.
+			if (!started) {
+				start   = timer_getTicks();
+				timed   = current;
+				started = true;
+			}
+
+			remaining = current;
+			deadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+		} else if (timer_isDeadlinePassed(deadline)) {
+			cdrom_cancelRead();
+			results->errors++;
+			return 0;
+		}
+	}
+
+	uint32_t length = timed * SECTOR_SIZE;
+	uint32_t time   = _getElapsed(start);
+
+	return time ? ((uint64_t) length * 1000000 / time) : 0;
+}
+
+static void _benchmarkSeeks(
+	CDBenchmarkResults *results, uint8_t *buffer, uint32_t numSectors
+) {
+	uint32_t seed = 0x1badb002;
+
+	for (int i = 0; i < NUM_SEEKS; i++) {
+		uint32_t lba = FIRST_LBA + (_nextRandom(&seed) % numSectors);
+
+		// Single-sector reads would otherwise be served from the cache.
+		sectorCache_invalidate();
+
+		uint32_t start = timer_getTicks();
+
+		if (!startCDROMRead(lba, buffer, 1, SECTOR_SIZE, true, true)) {
+			results->errors++;
+			continue;
+		}
+
+		uint32_t time = _getElapsed(start);
+		int      bucket;
+
+		_addSample(&results->seek, time);
+
+		for (bucket = 0; bucket < (CD_BENCHMARK_SEEK_BUCKETS - 1); bucket++) {
+			if (time < (cdBenchmarkSeekBuckets[bucket] * 1000u))
+				break;
+		}
+
+		results->seekHistogram[bucket]++;
+	}
+}
+
+static void _benchmarkAcks(CDBenchmarkResults *results) {
+	// Make sure the pause issued after the last read is not counted.
+	while (!cdrom_isQueueIdle())
+		__asm__ volatile("");
+
+	for (int i = 0; i < NUM_ACKS; i++) {
+		uint32_t    start  = timer_getTicks();
+		CDROMTicket ticket = cdrom_submitCommand(CDROM_CMD_NOP, 0, 0, 0, 0);
+
+		if (cdrom_waitForCommand(ticket) < 0) {
+			results->errors++;
+			continue;
+		}
+
+		_addSample(&results->ack, _getElapsed(start));
+	}
+}
+
+static void _benchmarkListings(
+	CDBenchmarkResults *results, uint8_t *buffer,
+	CDBenchmarkListingFunc listingFunc
+) {
+	for (int i = 0; i < NUM_LISTINGS; i++) {
+		uint32_t start = timer_getTicks();
+
+		listingFunc(buffer);
+		_addSample(&results->listing, _getElapsed(start));
+	}
+}
+
+void cdBenchmark_run(
+	CDBenchmarkResults *results, CDBenchmarkListingFunc listingFunc
+) {
+	memset(results, 0, sizeof(CDBenchmarkResults));
+	irq_resetStats();
+
+	uint8_t *buffer = malloc(BUFFER_SECTORS * SECTOR_SIZE);
+
+	if (!buffer) {
+		results->errors++;
+		return;
+	}
+
+	uint32_t numSectors = _getVolumeLength(buffer);
+
+	if (numSectors > FIRST_LBA) {
+		numSectors -= FIRST_LBA;
+		numSectors  = (numSectors < SEQUENTIAL_SECTORS)
+			? numSectors : SEQUENTIAL_SECTORS;
+
+		for (int speed = 0; speed < 2; speed++)
+			results->sequentialRate[speed] =
+				_benchmarkSequential(results, buffer, numSectors, speed);
+
+		_benchmarkSeeks(results, buffer, numSectors);
+	} else {
+		results->errors++;
+	}
+
+	_benchmarkAcks(results);
+
+	if (listingFunc)
+		_benchmarkListings(results, buffer, listingFunc);
+
+	free(buffer);
+	results->irqMaxTime = irq_getMaxHandlerTime();
+}
+
+size_t cdBenchmark_format(
+	const CDBenchmarkResults *results, char *output, size_t length
+) {
+	const CDBenchmarkStat *seek    = &results->seek;
+	const CDBenchmarkStat *ack     = &results->ack;
+	const CDBenchmarkStat *listing = &results->listing;
+	const uint16_t        *hist    = results->seekHistogram;
+
+	return snprintf(
+		output, length,
+		"Sequential: 1x %d KB/s, 2x %d KB/s\n"
+		"Seek us: min %d avg %d max %d\n"
+		" <5ms %d <10 %d <20 %d <50 %d\n"
+		" <100 %d <200 %d <500 %d slower %d\n"
+		"Ack us: min %d avg %d max %d\n"
+		"Listing us: min %d avg %d max %d\n"
+		"Longest IRQ handler run: %d us\n"
+		"Errors: %d\n",
+		results->sequentialRate[0] / 1024, results->sequentialRate[1] / 1024,
+		seek->min, _getAverage(seek), seek->max,
+		hist[0], hist[1], hist[2], hist[3],
+		hist[4], hist[5], hist[6], hist[7],
+		ack->min, _getAverage(ack), ack->max,
+		listing->min, _getAverage(listing), listing->max,
+		results->irqMaxTime,
+		results->errors
+	);
+}
@@ -0,0 +1,87 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CD_BENCHMARK_SEEK_BUCKETS 8
+
+typedef struct {
+	uint32_t min, max, total;
+	uint16_t count;
+} CDBenchmarkStat;
+
+// All times are in microseconds. Seek latencies are additionally sorted into a
+// histogram, whose bucket upper bounds are given by cdBenchmarkSeekBuckets[].
+typedef struct {
+	uint32_t        sequentialRate[2]; // Bytes per second at 1x and 2x
+	CDBenchmarkStat seek, ack, listing;
+	uint16_t        seekHistogram[CD_BENCHMARK_SEEK_BUCKETS];
+	uint32_t        irqMaxTime; // Longest time spent in the IRQ handler
+	uint16_t        errors;
+} CDBenchmarkResults;
+
+// Function used to fetch the first sector of the root directory listing from
+// the firmware, passed in by the caller as the listing protocol lives in the
+// menu itself.
+typedef void (*CDBenchmarkListingFunc)(void *buffer);
+
+extern const uint16_t cdBenchmarkSeekBuckets[CD_BENCHMARK_SEEK_BUCKETS];
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Runs all CD-ROM benchmarks on the currently inserted disc, blocking
+ * until done (which takes several seconds). The tests are, in order:
+ *
+ * - a single continuous read at 1x and 2x speed, timed over as much of the
+ *   disc as available (up to 1 MB);
+ * - single-sector reads at pseudorandom locations, to measure seek latency;
+ * - GetStat commands, to measure how long the drive takes to acknowledge a
+ *   command;
+ * - round trips of the firmware's directory listing request.
+ *
+ * The same pseudorandom sequence is used every time so that results can be
+ * compared across firmware releases and SD cards.
+ *
+ * @param results
+ * @param listingFunc Optional function used for the listing test
+ */
+void cdBenchmark_run(
+	CDBenchmarkResults *results, CDBenchmarkListingFunc listingFunc
+);
+
+/**
+ * @brief Formats the results as a human-readable, multi-line report suitable
+ * for both on-screen display and logging.
+ *
+ * @param results
+ * @param output
+ * @param length
+ * @return Length of the formatted report
+ */
+size_t cdBenchmark_format(
+	const CDBenchmarkResults *results, char *output, size_t length
+);
+
+#ifdef __cplusplus
+}
+#endif
@@ -41,6 +41,7 @@
 #include <string.h>
 #include "ps1/registers.h"
 #include "controller.h"
+#include "psxproject/irq.h"
 #include "psxproject/system.h"
 #include "logging.h"
 
@@ -65,6 +66,20 @@ void initControllerBus(void) {
          | SIO_CTRL_TX_ENABLE
          | SIO_CTRL_RX_ENABLE
          | SIO_CTRL_DSR_IRQ_ENABLE;
+
+     // Configure Timer 1 to count scanlines, reset on vblank and raise an IRQ
+     // every CONTROLLER_SAMPLE_INTERVAL lines to start a background poll.
+     TIMER_CTRL(1)   = 0;
+     TIMER_RELOAD(1) = CONTROLLER_SAMPLE_INTERVAL;
+     TIMER_CTRL(1)   = 0
+         | TIMER_CTRL_ENABLE_SYNC
+         | TIMER_CTRL_SYNC_RESET1
+         | TIMER_CTRL_RELOAD
+         | TIMER_CTRL_IRQ_ON_RELOAD
+         | TIMER_CTRL_IRQ_REPEAT
+         | TIMER_CTRL_EXT_CLOCK;
+
+     controller_unlockBus();
 }
  
 bool waitForAcknowledge(int timeout) {
@@ -185,10 +200,12 @@ bool waitForAcknowledge(int timeout) {
      // Send the request to the specified controller port and grab the response.
      // Note that this is a relatively slow process and should be done only once
      // per frame, unless higher polling rates are desired.
+     controller_lockBus();
      selectPort(port);
      int respLength = exchangePacket(
          ADDR_CONTROLLER, request, response, sizeof(request), sizeof(response)
      );
+     controller_unlockBus();
  
      if (respLength < 4 || response[1] != 0x5A) {
          // All controllers reply with at least 4 bytes of data.
@@ -204,6 +221,11 @@ bool waitForAcknowledge(int timeout) {
 }
 
 
+// Sends a packet to a device that does not necessarily acknowledge every byte
+// (such as a memory card PicoStation receiving a game ID). Each byte is sent
+// as soon as the previous one has been acknowledged, or after BYTE_DELAY if no
+// acknowledge arrives, so devices that do acknowledge are not slowed down by
+// the fixed delay.
 void sendPacketNoAcknowledge(
     DeviceAddress address, const uint8_t *request, int reqLength
 ) {
@@ -212,20 +234,20 @@ void sendPacketNoAcknowledge(
     delayMicroseconds(DTR_DELAY);
 
     SIO_DATA(0) = address;
-    delayMicroseconds(BYTE_DELAY);
+    waitForAcknowledge(BYTE_DELAY);
     while (SIO_STAT(0) & SIO_STAT_RX_NOT_EMPTY)
         SIO_DATA(0);
 
     for (; reqLength > 0; reqLength--) {
         exchangeByte(*(request++));
-        delayMicroseconds(BYTE_DELAY);
+        waitForAcknowledge(BYTE_DELAY);
     }
 
     delayMicroseconds(DTR_DELAY);
     SIO_CTRL(0) &= ~SIO_CTRL_DTR;
 }
 
-uint8_t checkMCPpresent(void)
+uint8_t checkMCPpresent(uint8_t ports)
 {
 	uint8_t ret = 0;
 	uint8_t request[5] = {CMD_GAME_ID_PING, 0, 0, 0, 0 };
@@ -233,8 +255,15 @@ uint8_t checkMCPpresent(void)
 	uint8_t requestID = CMD_CARD_IDENTIFY;
 	uint8_t responseID[9];
 	
+	controller_lockBus();
+
 	for (int i = 0; i < 2; i++)
 	{
+		if (!(ports & (1 << i)))
+		{
+			continue;
+		}
+
 		memset(response  , 0, 5);
 		memset(responseID, 0, 9);
 		selectPort(i);
@@ -256,6 +285,7 @@ uint8_t checkMCPpresent(void)
 #endif
 	}
 	
+	controller_unlockBus();
 	return ret;
 }
 
@@ -263,12 +293,20 @@ void sendGameID(const char *str, uint8_t card) {
     uint8_t request[64];
     size_t  length = strlen(str) + 1;
 
+    // Boot paths longer than the packet allows are truncated rather than
+    // overflowing the request buffer.
+    if (length > (sizeof(request) - 3))
+        length = sizeof(request) - 3;
+
     request[0] = CMD_GAME_ID_SEND;
     request[1] = 0;
     request[2] = length;
     __builtin_strncpy((char *)&request[3], str, length);
+    request[length + 2] = 0;
 
     // Send the ID on both ports.
+    controller_lockBus();
+
     for (int i = 0; i < 2; i++)
     {
 		if (card & (1 << i))
@@ -277,5 +315,232 @@ void sendGameID(const char *str, uint8_t card) {
 			sendPacketNoAcknowledge(ADDR_MEMORY_CARD, request, length+3);
         }
     }
+
+    controller_unlockBus();
+}
+
+
+/* IRQ-driven polling */
+
+typedef enum {
+    POLL_IDLE     = 0,
+    POLL_SELECT   = 1, // DTR asserted, waiting for the device to get ready
+    POLL_TRANSFER = 2, // Byte sent, waiting for the device to acknowledge it
+    POLL_RELEASE  = 3, // Transfer over, waiting to release DTR
+    POLL_NEXT     = 4  // DTR released, waiting to select the next port
+} PollState;
+
+static volatile uint8_t pollState   = POLL_IDLE;
+static volatile bool    pollEnabled = false;
+
+static uint8_t pollPort, pollIndex, pollRespLength;
+static uint8_t pollResponse[CONTROLLER_MAX_RESPONSE_LENGTH];
+
+// Each port's state is packed into a single word (buttons in bits 0-15, the
+// connected flag in bit 16, the analog flag in bit 17 and the sequence number
+// in bits 24-31), which is written and read atomically. The stick axes are
+// packed into a second word, which is always written first so that readers can
+// use the sequence number to detect a poll completing in between.
+static volatile uint32_t portSnapshots[CONTROLLER_NUM_PORTS];
+static volatile uint32_t portAxes[CONTROLLER_NUM_PORTS];
+
+// Presses seen since the last call to controller_takePressed(), along with the
+// frame in which the first of them was seen.
+static volatile uint16_t portPressed[CONTROLLER_NUM_PORTS];
+static volatile uint32_t portPressFrame[CONTROLLER_NUM_PORTS];
+
+static const uint8_t pollRequest[] = {
+    CMD_POLL, // Command
+    0x00,     // Multitap address
+    0x00,     // Rumble motor control 1
+    0x00      // Rumble motor control 2
+};
+
+// Arms Timer 0 to fire a single IRQ after the given number of microseconds
+// (up to ~1900). Writing to the control register also resets the counter.
+static void _startPollTimer(int time) {
+    TIMER_CTRL(0)   = 0;
+    IRQ_STAT        = ~(1 << IRQ_TIMER0);
+    TIMER_RELOAD(0) = (time * (F_CPU / 10000)) / 100;
+    TIMER_CTRL(0)   = TIMER_CTRL_RELOAD | TIMER_CTRL_IRQ_ON_RELOAD;
+}
+
+static void _selectPollPort(int port) {
+    pollPort       = port;
+    pollIndex      = 0;
+    pollRespLength = 0;
+    pollState      = POLL_SELECT;
+
+    selectPort(port);
+    IRQ_STAT     = ~(1 << IRQ_SIO0);
+    SIO_CTRL(0) |= SIO_CTRL_DTR | SIO_CTRL_ACKNOWLEDGE;
+    _startPollTimer(DTR_DELAY);
+}
+
+static void _publishPollResult(void) {
+    uint32_t snapshot = portSnapshots[pollPort];
+    snapshot          = (snapshot + (1 << 24)) & 0xff000000;
+
+    // All controllers reply with at least 4 bytes of data, of which bytes 2
+    // and 3 hold the state of all buttons (active low).
+    if ((pollRespLength >= 4) && (pollResponse[1] == 0x5A))
+        snapshot |= (1 << 16)
+            | ((pollResponse[2] | (pollResponse[3] << 8)) ^ 0xffff);
+
+    // The upper nibble of the first byte is the controller type, 7 for a
+    // DualShock in analog mode and 5 for an analog joystick; both report four
+    // stick axes after the buttons.
+    uint8_t type = pollResponse[0] >> 4;
+
+    if ((snapshot & (1 << 16)) && (pollRespLength >= 8) && ((type == 7) || (type == 5))) {
+        snapshot          |= 1 << 17;
+        portAxes[pollPort] = pollResponse[4]
+            | (pollResponse[5] <<  8)
+            | (pollResponse[6] << 16)
+            | (pollResponse[7] << 24);
+    }
+
+    uint16_t pressed = snapshot & ~portSnapshots[pollPort] & 0xffff;
+
+    if (pressed) {
+        if (!portPressed[pollPort])
+            portPressFrame[pollPort] = irq_getFrameCount();
+
+        portPressed[pollPort] |= pressed;
+    }
+
+    portSnapshots[pollPort] = snapshot;
+}
+
+void controller_startPoll(void) {
+    if (pollEnabled && (pollState == POLL_IDLE))
+        _selectPollPort(0);
+}
+
+void controller_handleAckInterrupt(void) {
+    SIO_CTRL(0) |= SIO_CTRL_ACKNOWLEDGE;
+
+    if (pollState != POLL_TRANSFER)
+        return;
+
+    if (!pollIndex) {
+        // The address byte has been acknowledged, so a device is present.
+        while (SIO_STAT(0) & SIO_STAT_RX_NOT_EMPTY)
+            SIO_DATA(0);
+    } else {
+        // The acknowledge pulse follows the byte, which takes at most 32 us to
+        // be transferred, so this never spins for long.
+        while (!(SIO_STAT(0) & SIO_STAT_RX_NOT_EMPTY))
+            __asm__ volatile("");
+
+        pollResponse[pollRespLength++] = SIO_DATA(0);
+    }
+
+    if (pollIndex >= CONTROLLER_MAX_RESPONSE_LENGTH) {
+        pollState = POLL_RELEASE;
+        _startPollTimer(DTR_DELAY);
+        return;
+    }
+
+    // Pad the request with zeroes if the response is longer.
+    SIO_DATA(0) = (pollIndex < sizeof(pollRequest)) ? pollRequest[pollIndex] : 0;
+    pollIndex++;
+    _startPollTimer(DSR_TIMEOUT);
 }
 
+void controller_handleTimerInterrupt(void) {
+    switch (pollState) {
+        case POLL_SELECT:
+            pollState   = POLL_TRANSFER;
+            SIO_DATA(0) = ADDR_CONTROLLER;
+            _startPollTimer(DSR_TIMEOUT);
+            break;
+
+        case POLL_TRANSFER:
+            // The device stopped acknowledging bytes (or no device is
+            // connected), but the last byte sent was still exchanged.
+            if (pollIndex && (SIO_STAT(0) & SIO_STAT_RX_NOT_EMPTY))
+                pollResponse[pollRespLength++] = SIO_DATA(0);
+
+            pollState = POLL_RELEASE;
+            _startPollTimer(DTR_DELAY);
+            break;
+
+        case POLL_RELEASE:
+            SIO_CTRL(0) &= ~SIO_CTRL_DTR;
+            _publishPollResult();
+
+            if ((pollPort + 1) < CONTROLLER_NUM_PORTS) {
+                pollState = POLL_NEXT;
+                _startPollTimer(DTR_POST_DELAY + DTR_PRE_DELAY);
+            } else {
+                pollState = POLL_IDLE;
+            }
+            break;
+
+        case POLL_NEXT:
+            _selectPollPort(pollPort + 1);
+            break;
+    }
+}
+
+void controller_getState(int port, ControllerState *state) {
+    uint32_t snapshot, axes;
+
+    do {
+        snapshot = portSnapshots[port];
+        axes     = portAxes[port];
+    } while (snapshot != portSnapshots[port]);
+
+    state->buttons   = snapshot & 0xffff;
+    state->connected = (snapshot >> 16) & 1;
+    state->analog    = (snapshot >> 17) & 1;
+    state->sequence  = snapshot >> 24;
+
+    for (int i = 0; i < 4; i++, axes >>= 8)
+        state->axes[i] = axes & 0xff;
+}
+
+uint16_t controller_getButtons(int port) {
+    return portSnapshots[port] & 0xffff;
+}
+
+uint16_t controller_takePressed(int port, uint32_t *frame) {
+    bool enable = disableInterrupts();
+
+    uint16_t pressed  = portPressed[port];
+    portPressed[port] = 0;
+
+    if (frame)
+        *frame = portPressFrame[port];
+
+    if (enable)
+        enableInterrupts();
+
+    return pressed;
+}
+
+void controller_lockBus(void) {
+    pollEnabled = false;
+
+    while (pollState != POLL_IDLE)
+        __asm__ volatile("");
+
+    // Synchronous transfers poll the SIO0 IRQ flag themselves, so the IRQ
+    // handler must not acknowledge it.
+    bool enable = disableInterrupts();
+    IRQ_MASK   &= ~(1 << IRQ_SIO0);
+
+    if (enable)
+        enableInterrupts();
+}
+
+void controller_unlockBus(void) {
+    bool enable = disableInterrupts();
+    IRQ_STAT    = ~(1 << IRQ_SIO0);
+    IRQ_MASK   |= 1 << IRQ_SIO0;
+    pollEnabled = true;
+
+    if (enable)
+        enableInterrupts();
+}
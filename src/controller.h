@@ -1,3 +1,4 @@
+#pragma once
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -55,7 +56,16 @@ typedef enum {
 void delayMicroseconds(int time);
 void sendPacketNoAcknowledge(DeviceAddress address, const uint8_t *request, int reqLength);
 void sendGameID(const char *str, uint8_t card);
-uint8_t checkMCPpresent(void);
+
+/**
+ * @brief Checks which of the given ports have a memory card PicoStation
+ * plugged in. Each port checked takes a few milliseconds.
+ *
+ * @param ports Bitmask of ports to check (bit 0 for port 1, bit 1 for port 2)
+ * @return Bitmask of ports an MCP was found in
+ */
+uint8_t checkMCPpresent(uint8_t ports);
+
 void initControllerBus(void);
 bool waitForAcknowledge(int timeout);
 void selectPort(int port);
@@ -66,4 +76,82 @@ int exchangePacket(
 );
 uint16_t getButtonPress(int port);
 
+/* IRQ-driven polling */
+
+// Controllers are polled in the background by a state machine driven by SIO0
+// acknowledge IRQs, with Timer 0 providing the delays and timeouts in between
+// bytes. A poll of both ports is started by Timer 1 every
+// CONTROLLER_SAMPLE_INTERVAL scanlines, counting from the start of vblank (4
+// samples per frame on NTSC, 5 on PAL), and the result is published as a
+// single 32-bit word so that it can be read at any time without disabling
+// interrupts. The last sample of each frame lands about 1.5 ms before vblank,
+// so the main loop always sees buttons sampled right before it builds the
+// next frame.
+#define CONTROLLER_NUM_PORTS           2
+#define CONTROLLER_MAX_RESPONSE_LENGTH 32
+#define CONTROLLER_SAMPLE_INTERVAL     60
+
+// Stick axes reported by analog controllers (DualShock in analog mode, analog
+// joysticks), in the order they appear in the poll response. Each axis ranges
+// from 0x00 (left/up) to 0xff (right/down), with 0x80 at the center.
+typedef enum {
+    AXIS_RIGHT_X = 0,
+    AXIS_RIGHT_Y = 1,
+    AXIS_LEFT_X  = 2,
+    AXIS_LEFT_Y  = 3
+} ControllerAxis;
+
+typedef struct {
+    uint16_t buttons;
+    bool     connected, analog;
+    uint8_t  sequence; // Incremented every time the port is polled
+    uint8_t  axes[4];  // Only valid if analog is set
+} ControllerState;
+
+void controller_startPoll(void);
+void controller_handleAckInterrupt(void);
+void controller_handleTimerInterrupt(void);
+
+/**
+ * @brief Returns the state of the controller in the given port as of the last
+ * completed background poll. May be called from an IRQ handler.
+ *
+ * @param port
+ * @param state
+ */
+void controller_getState(int port, ControllerState *state);
+
+/**
+ * @brief Returns the buttons held on the controller in the given port as of
+ * the last completed background poll, or 0 if no controller is connected.
+ *
+ * @param port
+ */
+uint16_t controller_getButtons(int port);
+
+/**
+ * @brief Returns the buttons that went from released to pressed in any
+ * background poll since the last call, and clears them. This catches presses
+ * that are released again before the main loop gets to read the buttons.
+ *
+ * @param port
+ * @param frame Optional pointer to variable to store the frame count (as
+ * returned by irq_getFrameCount()) of the poll in which the first of these
+ * presses was seen
+ */
+uint16_t controller_takePressed(int port, uint32_t *frame);
+
+/**
+ * @brief Waits for the background poll in progress (if any) to finish and
+ * stops further polls, giving exclusive access to the bus to functions that
+ * exchange packets synchronously, such as checkMCPpresent(). Must not be
+ * called from an IRQ handler.
+ */
+void controller_lockBus(void);
+
+/**
+ * @brief Resumes background polling after a call to controller_lockBus().
+ */
+void controller_unlockBus(void);
+
 
@@ -0,0 +1,62 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include "font.h"
+#include "fontGlyphs.h"
+#include "gpu.h"
+#include "ps1/gpucmd.h"
+
+void printString(DMAChain *chain, int x, int y, const char *str) {
+	int currentX = x, currentY = y;
+
+	// The font lives in the same texture atlas as every other UI image, whose
+	// texpage is set once at the beginning of each frame, so there is no need
+	// to send a texpage command here.
+	for (; *str; str++) {
+		uint8_t ch = (uint8_t) *str;
+
+		// Tabs and newlines only affect the layout. Every other character has
+		// an entry in the glyph table; invalid characters are mapped by
+		// convertFont.py to a box with a question mark (character code 127).
+		switch (ch) {
+			case '\t':
+				currentX += FONT_TAB_WIDTH - 1;
+				currentX -= currentX % FONT_TAB_WIDTH;
+				continue;
+
+			case '\n':
+				currentX  = x;
+				currentY += FONT_LINE_HEIGHT;
+				continue;
+		}
+
+		const FontGlyph *glyph = &fontGlyphs[ch];
+
+		// Draw the character using the prebuilt UV and size words. Enable
+		// blending to make sure any semitransparent pixels in the font get
+		// rendered correctly.
+		if (glyph->size) {
+			uint32_t *ptr = allocatePacket(chain, 4);
+			ptr[0] = gp0_rectangle(true, true, true);
+			ptr[1] = gp0_xy(currentX, currentY);
+			ptr[2] = glyph->uv;
+			ptr[3] = glyph->size;
+		}
+
+		currentX += glyph->advance;
+	}
+}
@@ -0,0 +1,38 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "gpu.h"
+
+// Glyph table entry as generated by convertFont.py. The UV and size fields are
+// copied as-is into a textured rectangle command; a size of zero means nothing
+// has to be drawn (i.e. the glyph is a space).
+typedef struct {
+	uint32_t uv, size;
+	uint8_t  advance;
+} FontGlyph;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void printString(DMAChain *chain, int x, int y, const char *str);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,192 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "controller.h"
+#include "input.h"
+#include "logging.h"
+#include "psxproject/irq.h"
+
+#if DEBUG_CONTROLLER
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+typedef struct {
+	uint32_t nextRepeat;
+	uint16_t interval;
+	uint8_t  count, repeats;
+} RepeatState;
+
+static int      _port = 0;
+static uint16_t _heldButtons;
+static int32_t  _analogAccumulator;
+
+static const InputRepeatCurve *_curves[INPUT_NUM_BUTTONS];
+static RepeatState            _repeatStates[INPUT_NUM_BUTTONS];
+
+static InputEvent _queue[INPUT_QUEUE_LENGTH];
+static uint32_t   _queueHead, _queueTail;
+
+static void _pushEvent(uint32_t time, uint16_t button, InputEventType type, int count) {
+	// If the queue is full the oldest event is dropped, as it is most likely
+	// stale anyway.
+	if ((_queueHead - _queueTail) >= INPUT_QUEUE_LENGTH) {
+		DEBUG_PRINT("Input queue full, dropping event\n");
+		_queueTail++;
+	}
+
+	InputEvent *event = &_queue[_queueHead++ % INPUT_QUEUE_LENGTH];
+
+	event->time   = time;
+	event->button = button;
+	event->type   = type;
+	event->count  = count;
+}
+
+static void _startRepeat(int index, uint32_t time) {
+	const InputRepeatCurve *curve = _curves[index];
+	RepeatState            *state = &_repeatStates[index];
+
+	if (!curve)
+		return;
+
+	state->nextRepeat = time + curve->delay;
+	state->interval   = curve->interval;
+	state->count      = 1;
+	state->repeats    = 0;
+}
+
+static void _updateRepeat(int index, uint32_t time) {
+	const InputRepeatCurve *curve = _curves[index];
+	RepeatState            *state = &_repeatStates[index];
+
+	if (!curve || (((int32_t) (time - state->nextRepeat)) < 0))
+		return;
+
+	_pushEvent(time, 1 << index, INPUT_EVENT_REPEAT, state->count);
+	state->nextRepeat = time + state->interval;
+
+	if (++state->repeats < curve->accelerateAfter)
+		return;
+
+	state->repeats = 0;
+
+	if (state->interval > curve->minInterval) {
+		state->interval /= 2;
+
+		if (state->interval < curve->minInterval)
+			state->interval = curve->minInterval;
+	} else if (state->count < curve->maxCount) {
+		state->count *= 2;
+
+		if (state->count > curve->maxCount)
+			state->count = curve->maxCount;
+	}
+}
+
+void input_init(int port) {
+	_port              = port;
+	_heldButtons       = controller_getButtons(port);
+	_analogAccumulator = 0;
+	_queueHead         = 0;
+	_queueTail         = 0;
+
+	for (int i = 0; i < INPUT_NUM_BUTTONS; i++)
+		_curves[i] = 0;
+
+	// Discard any presses latched before the menu was ready for them.
+	controller_takePressed(port, 0);
+}
+
+void input_setRepeatCurve(uint16_t buttons, const InputRepeatCurve *curve) {
+	for (int i = 0; i < INPUT_NUM_BUTTONS; i++) {
+		if (buttons & (1 << i))
+			_curves[i] = curve;
+	}
+}
+
+void input_update(void) {
+	uint32_t pressFrame;
+	uint32_t time    = irq_getFrameCount();
+	uint16_t held    = controller_getButtons(_port);
+	uint16_t pressed = controller_takePressed(_port, &pressFrame);
+
+	// Buttons that were both pressed and released since the last update are
+	// still reported as a press followed by a release.
+	uint16_t released = (_heldButtons | pressed) & ~held;
+
+	for (int i = 0; i < INPUT_NUM_BUTTONS; i++) {
+		uint16_t mask = 1 << i;
+
+		if (pressed & mask) {
+			_pushEvent(pressFrame, mask, INPUT_EVENT_PRESS, 1);
+			_startRepeat(i, time);
+		} else if (held & mask) {
+			_updateRepeat(i, time);
+		}
+
+		if (released & mask)
+			_pushEvent(time, mask, INPUT_EVENT_RELEASE, 1);
+	}
+
+	_heldButtons = held;
+}
+
+bool input_getEvent(InputEvent *event) {
+	if (_queueTail == _queueHead)
+		return false;
+
+	*event = _queue[_queueTail++ % INPUT_QUEUE_LENGTH];
+	return true;
+}
+
+int input_getAnalogScroll(void) {
+	ControllerState state;
+	controller_getState(_port, &state);
+
+	if (!state.connected || !state.analog) {
+		_analogAccumulator = 0;
+		return 0;
+	}
+
+	int deflection = state.axes[AXIS_LEFT_Y] - 0x80;
+	int magnitude  = (deflection < 0) ? -deflection : deflection;
+
+	if (magnitude < INPUT_ANALOG_DEAD_ZONE) {
+		_analogAccumulator = 0;
+		return 0;
+	}
+
+	// Rescale the deflection past the dead zone to 0-256 and square it to get
+	// the speed, in 1/256ths of a step per frame (assuming 60 frames per
+	// second).
+	magnitude = ((magnitude - INPUT_ANALOG_DEAD_ZONE) * 256)
+		/ (128 - INPUT_ANALOG_DEAD_ZONE);
+
+	int speed = (magnitude * magnitude * INPUT_ANALOG_MAX_SPEED) / (60 * 256);
+
+	_analogAccumulator += (deflection < 0) ? -speed : speed;
+
+	int steps           = _analogAccumulator / 256;
+	_analogAccumulator -= steps * 256;
+
+	return steps;
+}
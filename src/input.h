@@ -0,0 +1,105 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Button state is turned into a queue of events, timestamped with the frame
+// count (see irq_getFrameCount()) at which they were detected. Buttons with a
+// repeat curve assigned generate repeat events while held, which get more
+// frequent and eventually cover more than one step each the longer the button
+// is held.
+#define INPUT_QUEUE_LENGTH 32
+#define INPUT_NUM_BUTTONS  16
+
+// Analog stick deflections smaller than this (out of 128) are ignored. Past
+// it, the scrolling speed grows with the square of the deflection, up to
+// INPUT_ANALOG_MAX_SPEED steps per second at full deflection.
+#define INPUT_ANALOG_DEAD_ZONE 40
+#define INPUT_ANALOG_MAX_SPEED 2400
+
+typedef enum {
+	INPUT_EVENT_PRESS   = 0,
+	INPUT_EVENT_REPEAT  = 1,
+	INPUT_EVENT_RELEASE = 2
+} InputEventType;
+
+typedef struct {
+	uint32_t time;   // Frame count at which the event was detected
+	uint16_t button; // BUTTON_MASK_* value
+	uint8_t  type;   // InputEventType value
+	uint8_t  count;  // Number of steps covered (always 1 for presses)
+} InputEvent;
+
+// All times are in frames. Every accelerateAfter repeats, the interval between
+// repeats is halved until it reaches minInterval; after that, the number of
+// steps covered by each repeat is doubled instead until it reaches maxCount.
+typedef struct {
+	uint16_t delay, interval, minInterval;
+	uint8_t  accelerateAfter, maxCount;
+} InputRepeatCurve;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Resets the input layer and selects the controller port to read from.
+ * All repeat curves are cleared.
+ *
+ * @param port
+ */
+void input_init(int port);
+
+/**
+ * @brief Sets the repeat curve used for one or more buttons. The curve is not
+ * copied and must remain valid.
+ *
+ * @param buttons Bitmask of BUTTON_MASK_* values
+ * @param curve Curve to use, or NULL to disable repeats
+ */
+void input_setRepeatCurve(uint16_t buttons, const InputRepeatCurve *curve);
+
+/**
+ * @brief Reads the controller's state and queues events for all changes since
+ * the last call. Presses and releases happening in between calls are not lost,
+ * as presses are latched by the background controller poll. Meant to be called
+ * once per frame.
+ */
+void input_update(void);
+
+/**
+ * @brief Removes the oldest event from the queue.
+ *
+ * @param event
+ * @return False if the queue is empty, true otherwise
+ */
+bool input_getEvent(InputEvent *event);
+
+/**
+ * @brief Returns the number of steps to scroll by in the current frame based
+ * on the vertical axis of the left analog stick (negative for up), or 0 if no
+ * analog controller is connected. Fractional steps are carried over to
+ * following frames, so that slow scrolling is still smooth.
+ */
+int input_getAnalogScroll(void);
+
+#ifdef __cplusplus
+}
+#endif
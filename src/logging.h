@@ -5,5 +5,7 @@
 #define DEBUG_CDROM 0
 #define DEBUG_CONTROLLER 0
 #define DEBUG_MAIN 0
+#define DEBUG_ASSET 0
+#define DEBUG_TASK 0
 
-#define DEBUG_LOGGING_ENABLED (DEBUG_SPU || DEBUG_FS || DEBUG_CDROM || DEBUG_MAIN || DEBUG_CONTROLLER)
+#define DEBUG_LOGGING_ENABLED (DEBUG_SPU || DEBUG_FS || DEBUG_CDROM || DEBUG_MAIN || DEBUG_CONTROLLER || DEBUG_ASSET || DEBUG_TASK)
@@ -0,0 +1,113 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+#define MIN_MATCH 4
+
+// Lengths that do not fit in the 4-bit fields of a token are extended using
+// additional bytes, each of which is added to the length; a byte other than
+// 255 terminates the sequence.
+static const uint8_t *_readLength(
+	const uint8_t *input, const uint8_t *inputEnd, size_t *length
+) {
+	uint8_t value;
+
+	do {
+		if (input >= inputEnd)
+			return 0;
+
+		value    = *(input++);
+		*length += value;
+	} while (value == 255);
+
+	return input;
+}
+
+size_t lz4_decompress(
+	void *output, size_t outputLength, const void *input, size_t inputLength
+) {
+	const uint8_t *in     = (const uint8_t *) input;
+	const uint8_t *inEnd  = in + inputLength;
+	uint8_t       *out    = (uint8_t *) output;
+	uint8_t       *outEnd = out + outputLength;
+
+	while (in < inEnd) {
+		uint8_t token  = *(in++);
+		size_t  length = token >> 4;
+
+		// Copy the literals preceding the match.
+		if (length == 15) {
+			in = _readLength(in, inEnd, &length);
+
+			if (!in)
+				return 0;
+		}
+		if (
+			((size_t) (inEnd - in) < length) ||
+			((size_t) (outEnd - out) < length)
+		)
+			return 0;
+
+		memcpy(out, in, length);
+		in  += length;
+		out += length;
+
+		// The last sequence in a block only contains literals.
+		if (in >= inEnd)
+			break;
+		if ((inEnd - in) < 2)
+			return 0;
+
+		size_t offset = in[0] | (in[1] << 8);
+		in           += 2;
+
+		if (!offset || (offset > (size_t) (out - (uint8_t *) output)))
+			return 0;
+
+		length = token & 15;
+
+		if (length == 15) {
+			in = _readLength(in, inEnd, &length);
+
+			if (!in)
+				return 0;
+		}
+
+		length += MIN_MATCH;
+
+		if ((size_t) (outEnd - out) < length)
+			return 0;
+
+		// Matches may overlap the data being written (which is how runs of
+		// repeated bytes are encoded), in which case they have to be copied
+		// one byte at a time.
+		const uint8_t *match = out - offset;
+
+		if (offset >= length) {
+			memcpy(out, match, length);
+			out += length;
+		} else {
+			for (; length; length--)
+				*(out++) = *(match++);
+		}
+	}
+
+	return out - (uint8_t *) output;
+}
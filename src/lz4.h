@@ -0,0 +1,43 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Decompresses a raw LZ4 block (without any frame header) into the
+ * provided buffer. The data is validated while being decompressed, so a
+ * corrupted or truncated block will never result in writes outside of the
+ * output buffer.
+ *
+ * @param output
+ * @param outputLength Size of the output buffer
+ * @param input
+ * @param inputLength Length of the compressed block
+ * @return Number of bytes written, or 0 if the block is invalid
+ */
+size_t lz4_decompress(
+	void *output, size_t outputLength, const void *input, size_t inputLength
+);
+
+#ifdef __cplusplus
+}
+#endif
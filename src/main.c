@@ -40,17 +40,30 @@
 #include "ps1/gpucmd.h"
 #include "ps1/registers.h"
 #include "ps1/cdrom.h"
+#include "psxproject/cdfile.h"
 #include "psxproject/cdrom.h"
+#include "psxproject/exeloader.h"
 #include "psxproject/filesystem.h"
 #include "psxproject/irq.h"
+#include "psxproject/sectorcache.h"
 #include "gpu.h"
 #include "controller.h"
 #include "psxproject/system.h"
 #include "psxproject/spu.h"
+#include "psxproject/stream.h"
+#include "psxproject/task.h"
+#include "psxproject/timer.h"
 #include <stdlib.h>
 #include "file_manager.h"
 #include "counters.h"
 #include "logging.h"
+#include "asset.h"
+#include "asset_pack.h"
+#include "cd_benchmark.h"
+#include "atlas.h"
+#include "font.h"
+#include "input.h"
+#include "system_cnf.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -65,137 +78,7 @@
 #endif
 
 #define SFX_VOL	10922 // 2/3 of maximal volume
-
-// In order to pick sprites (characters) out of our spritesheet, we need a table
-// listing all of them (in ASCII order in this case) with their UV coordinates
-// within the sheet as well as their dimensions. In this example we're going to
-// hardcode the table, however in an actual game you may want to store this data
-// in the same file as the image and palette data.
-typedef struct
-{
-	uint8_t x, y, width, height;
-} SpriteInfo;
-
-static const SpriteInfo fontSprites[] = {
-	{.x = 6, .y = 0, .width = 2, .height = 9},	   // !
-	{.x = 12, .y = 0, .width = 4, .height = 9},	   // "
-	{.x = 18, .y = 0, .width = 6, .height = 9},	   // #
-	{.x = 24, .y = 0, .width = 6, .height = 9},	   // $
-	{.x = 30, .y = 0, .width = 6, .height = 9},	   // %
-	{.x = 36, .y = 0, .width = 6, .height = 9},	   // &
-	{.x = 42, .y = 0, .width = 2, .height = 9},	   // '
-	{.x = 48, .y = 0, .width = 3, .height = 9},	   // (
-	{.x = 54, .y = 0, .width = 3, .height = 9},	   // )
-	{.x = 60, .y = 0, .width = 4, .height = 9},	   // *
-	{.x = 66, .y = 0, .width = 6, .height = 9},	   // +
-	{.x = 72, .y = 0, .width = 3, .height = 9},	   // ,
-	{.x = 78, .y = 0, .width = 6, .height = 9},	   // -
-	{.x = 84, .y = 0, .width = 2, .height = 9},	   // .
-	{.x = 90, .y = 0, .width = 6, .height = 9},	   // /
-	{.x = 0, .y = 9, .width = 6, .height = 9},	   // 0
-	{.x = 6, .y = 9, .width = 6, .height = 9},	   // 1
-	{.x = 12, .y = 9, .width = 6, .height = 9},	   // 2
-	{.x = 18, .y = 9, .width = 6, .height = 9},	   // 3
-	{.x = 24, .y = 9, .width = 6, .height = 9},	   // 4
-	{.x = 30, .y = 9, .width = 6, .height = 9},	   // 5
-	{.x = 36, .y = 9, .width = 6, .height = 9},	   // 6
-	{.x = 42, .y = 9, .width = 6, .height = 9},	   // 7
-	{.x = 48, .y = 9, .width = 6, .height = 9},	   // 8
-	{.x = 54, .y = 9, .width = 6, .height = 9},	   // 9
-	{.x = 60, .y = 9, .width = 2, .height = 9},	   // :
-	{.x = 66, .y = 9, .width = 3, .height = 9},	   // ;
-	{.x = 72, .y = 9, .width = 6, .height = 9},	   // <
-	{.x = 78, .y = 9, .width = 6, .height = 9},	   // =
-	{.x = 84, .y = 9, .width = 6, .height = 9},	   // >
-	{.x = 90, .y = 9, .width = 6, .height = 9},	   // ?
-	{.x = 0, .y = 18, .width = 6, .height = 9},	   // @
-	{.x = 6, .y = 18, .width = 6, .height = 9},	   // A
-	{.x = 12, .y = 18, .width = 6, .height = 9},   // B
-	{.x = 18, .y = 18, .width = 6, .height = 9},   // C
-	{.x = 24, .y = 18, .width = 6, .height = 9},   // D
-	{.x = 30, .y = 18, .width = 6, .height = 9},   // E
-	{.x = 36, .y = 18, .width = 6, .height = 9},   // F
-	{.x = 42, .y = 18, .width = 6, .height = 9},   // G
-	{.x = 48, .y = 18, .width = 6, .height = 9},   // H
-	{.x = 54, .y = 18, .width = 4, .height = 9},   // I
-	{.x = 60, .y = 18, .width = 5, .height = 9},   // J
-	{.x = 66, .y = 18, .width = 6, .height = 9},   // K
-	{.x = 72, .y = 18, .width = 6, .height = 9},   // L
-	{.x = 78, .y = 18, .width = 6, .height = 9},   // M
-	{.x = 84, .y = 18, .width = 6, .height = 9},   // N
-	{.x = 90, .y = 18, .width = 6, .height = 9},   // O
-	{.x = 0, .y = 27, .width = 6, .height = 9},	   // P
-	{.x = 6, .y = 27, .width = 6, .height = 9},	   // Q
-	{.x = 12, .y = 27, .width = 6, .height = 9},   // R
-	{.x = 18, .y = 27, .width = 6, .height = 9},   // S
-	{.x = 24, .y = 27, .width = 6, .height = 9},   // T
-	{.x = 30, .y = 27, .width = 6, .height = 9},   // U
-	{.x = 36, .y = 27, .width = 6, .height = 9},   // V
-	{.x = 42, .y = 27, .width = 6, .height = 9},   // W
-	{.x = 48, .y = 27, .width = 6, .height = 9},   // X
-	{.x = 54, .y = 27, .width = 6, .height = 9},   // Y
-	{.x = 60, .y = 27, .width = 6, .height = 9},   // Z
-	{.x = 66, .y = 27, .width = 3, .height = 9},   // [
-	{.x = 72, .y = 27, .width = 6, .height = 9},   // Backslash
-	{.x = 78, .y = 27, .width = 3, .height = 9},   // ]
-	{.x = 84, .y = 27, .width = 4, .height = 9},   // ^
-	{.x = 90, .y = 27, .width = 6, .height = 9},   // _
-	{.x = 0, .y = 36, .width = 3, .height = 9},	   // `
-	{.x = 6, .y = 36, .width = 6, .height = 9},	   // a
-	{.x = 12, .y = 36, .width = 6, .height = 9},   // b
-	{.x = 18, .y = 36, .width = 6, .height = 9},   // c
-	{.x = 24, .y = 36, .width = 6, .height = 9},   // d
-	{.x = 30, .y = 36, .width = 6, .height = 9},   // e
-	{.x = 36, .y = 36, .width = 5, .height = 9},   // f
-	{.x = 42, .y = 36, .width = 6, .height = 9},   // g
-	{.x = 48, .y = 36, .width = 5, .height = 9},   // h
-	{.x = 54, .y = 36, .width = 2, .height = 9},   // i
-	{.x = 60, .y = 36, .width = 4, .height = 9},   // j
-	{.x = 66, .y = 36, .width = 5, .height = 9},   // k
-	{.x = 72, .y = 36, .width = 2, .height = 9},   // l
-	{.x = 78, .y = 36, .width = 6, .height = 9},   // m
-	{.x = 84, .y = 36, .width = 5, .height = 9},   // n
-	{.x = 90, .y = 36, .width = 6, .height = 9},   // o
-	{.x = 0, .y = 45, .width = 6, .height = 9},	   // p
-	{.x = 6, .y = 45, .width = 6, .height = 9},	   // q
-	{.x = 12, .y = 45, .width = 6, .height = 9},   // r
-	{.x = 18, .y = 45, .width = 6, .height = 9},   // s
-	{.x = 24, .y = 45, .width = 5, .height = 9},   // t
-	{.x = 30, .y = 45, .width = 5, .height = 9},   // u
-	{.x = 36, .y = 45, .width = 6, .height = 9},   // v
-	{.x = 42, .y = 45, .width = 6, .height = 9},   // w
-	{.x = 48, .y = 45, .width = 6, .height = 9},   // x
-	{.x = 54, .y = 45, .width = 6, .height = 9},   // y
-	{.x = 60, .y = 45, .width = 5, .height = 9},   // z
-	{.x = 66, .y = 45, .width = 4, .height = 9},   // {
-	{.x = 72, .y = 45, .width = 2, .height = 9},   // |
-	{.x = 78, .y = 45, .width = 4, .height = 9},   // }
-	{.x = 84, .y = 45, .width = 6, .height = 9},   // ~
-	{.x = 90, .y = 45, .width = 6, .height = 9},   // Invalid character
-	{.x = 0, .y = 54, .width = 6, .height = 9},	   //
-	{.x = 6, .y = 54, .width = 6, .height = 9},	   //
-	{.x = 12, .y = 54, .width = 4, .height = 9},   //
-	{.x = 18, .y = 54, .width = 4, .height = 9},   //
-	{.x = 24, .y = 54, .width = 6, .height = 9},   //
-	{.x = 30, .y = 54, .width = 6, .height = 9},   //
-	{.x = 36, .y = 54, .width = 6, .height = 9},   //
-	{.x = 42, .y = 54, .width = 6, .height = 9},   //
-	{.x = 0, .y = 63, .width = 7, .height = 9},	   //
-	{.x = 12, .y = 63, .width = 7, .height = 9},   //
-	{.x = 24, .y = 63, .width = 9, .height = 9},   //
-	{.x = 36, .y = 63, .width = 8, .height = 10},  //
-	{.x = 48, .y = 63, .width = 11, .height = 10}, //
-	{.x = 60, .y = 63, .width = 12, .height = 10}, //
-	{.x = 72, .y = 63, .width = 14, .height = 9},  //
-	{.x = 0, .y = 73, .width = 10, .height = 10},  //
-	{.x = 12, .y = 73, .width = 10, .height = 10}, //
-	{.x = 24, .y = 73, .width = 10, .height = 10}, //
-	{.x = 36, .y = 73, .width = 10, .height = 9},  //
-	{.x = 48, .y = 73, .width = 10, .height = 9},  //
-	{.x = 60, .y = 73, .width = 10, .height = 10},  //
-	{.x = 72, .y = 73, .width = 10, .height = 10},  //
-	{.x = 85, .y = 73, .width = 8, .height = 8}  //
-};
+#define MUSIC_VOL	8192 // 1/2 of maximal volume
 
 typedef enum
 {
@@ -205,9 +88,17 @@ typedef enum
 	MENU_COMMAND_GOTO_DIRECTORY = 0x3,
 	MENU_COMMAND_MOUNT_FILE_FAST = 0x4,
 	MENU_COMMAND_MOUNT_FILE_SLOW = 0x5,
-	MENU_COMMAND_BOOTLOADER = 0x6
+	MENU_COMMAND_BOOTLOADER = 0x6,
+	MENU_COMMAND_BENCHMARK = 0x7
 } MENU_COMMAND;
 
+typedef enum
+{
+	MOUNT_PHASE_NONE = 0x0,
+	MOUNT_PHASE_WAIT_IMAGE = 0x1,
+	MOUNT_PHASE_WAIT_TOC = 0x2
+} MOUNT_PHASE;
+
 typedef enum
 {
 	COMMAND_GOTO_ROOT = 0x1,
@@ -226,91 +117,16 @@ typedef enum
 	IO_COMMAND_GAMEID = 0x1,
 } IO_COMMAND;
 
-#define FONT_FIRST_TABLE_CHAR '!'
-#define FONT_SPACE_WIDTH 4
-#define FONT_TAB_WIDTH 32
-#define FONT_LINE_HEIGHT 10
-
 static void sendCommand(uint8_t command, uint16_t argument)
 {
 	uint8_t test[] = {CDROM_TEST_DSP_CMD, (uint8_t)(0xF0 | command), (uint8_t)((argument >> 8) & 0xFF), (uint8_t)(argument & 0xFF)};
 	issueCDROMCommand(CDROM_CMD_TEST, test, sizeof(test));
 }
 
-static void printString(
-	DMAChain *chain, const TextureInfo *font, int x, int y, const char *str)
-{
-	int currentX = x, currentY = y;
-
-	uint32_t *ptr;
-
-	// Start by sending a texpage command to tell the GPU to use the font's
-	// spritesheet. Note that the texpage command before a drawing command can
-	// be omitted when reusing the same texture, so sending it here just once is
-	// enough.
-	ptr = allocatePacket(chain, 1);
-	ptr[0] = gp0_texpage(font->page, false, false);
-
-	// Iterate over every character in the string.
-	for (; *str; str++)
-	{
-		uint8_t ch = (uint8_t)*str;
-
-		// Check if the character is "special" and shall be handled without
-		// drawing any sprite, or if it's invalid and should be rendered as a
-		// box with a question mark (character code 127).
-		switch (ch)
-		{
-		case '\t':
-			currentX += FONT_TAB_WIDTH - 1;
-			currentX -= currentX % FONT_TAB_WIDTH;
-			continue;
-
-		case '\n':
-			currentX = x;
-			currentY += FONT_LINE_HEIGHT;
-			continue;
-
-		case ' ':
-			currentX += FONT_SPACE_WIDTH;
-			continue;
-		}
-		if (ch >= 0x99 && ch <= 0xFF)
-		{
-			ch = '\x7f';
-		}
-
-		// If the character was not a tab, newline or space, fetch its
-		// respective entry from the sprite coordinate table.
-		const SpriteInfo *sprite = &fontSprites[ch - FONT_FIRST_TABLE_CHAR];
-
-		// Draw the character, summing the UV coordinates of the spritesheet in
-		// VRAM to those of the sprite itself within the sheet. Enable blending
-		// to make sure any semitransparent pixels in the font get rendered
-		// correctly.
-		ptr = allocatePacket(chain, 4);
-		ptr[0] = gp0_rectangle(true, true, true);
-		ptr[1] = gp0_xy(currentX, currentY);
-		ptr[2] = gp0_uv(font->u + sprite->x, font->v + sprite->y, font->clut);
-		ptr[3] = gp0_xy(sprite->width, sprite->height);
-
-		// Move onto the next character.
-		currentX += sprite->width;
-	}
-}
-
 #define SCREEN_WIDTH 320
 #define SCREEN_HEIGHT 240
-#define FONT_WIDTH 96
-#define FONT_HEIGHT 84
-#define FONT_COLOR_DEPTH GP0_COLOR_4BPP
-
-#define TEXTURE_WIDTH 128
-#define TEXTURE_HEIGHT 20
-#define TEXTURE_COLOR_DEPTH GP0_COLOR_4BPP
 
-extern const uint8_t fontTexture[], fontPalette[], logoTexture[], logoPalette[];
-extern const uint8_t click_sfx[], slide_sfx[];
+extern const uint8_t atlasTexture[];
 
 #define c_maxFilePathLength 255
 #define c_maxFilePathLengthWithTerminator c_maxFilePathLength + 1
@@ -372,33 +188,245 @@ uint32_t list_load(void *sectorBuffer, uint8_t command, uint16_t argument)
 	return fileEntryCount;
 }
 
+// Directory listings are loaded by a separate task, so that the menu keeps
+// drawing frames while waiting for the drive. The task waits for a request,
+// loads the listing and clears busy once done. The file list must not be
+// accessed while the task is busy.
+#define LISTING_TASK_STACK_SIZE 0x4000
+
+typedef struct
+{
+	TaskEvent request;
+	void *sectorBuffer;
+	uint8_t command;
+	uint16_t argument;
+	uint32_t fileEntryCount;
+	bool busy;
+} ListingJob;
+
+static void listingTask(void *arg)
+{
+	ListingJob *job = (ListingJob *)arg;
+
+	for (;;)
+	{
+		task_waitForEvent(&job->request, 0);
+		job->fileEntryCount = list_load(job->sectorBuffer, job->command, job->argument);
+		job->busy = false;
+	}
+}
+
+static void startListing(ListingJob *job, uint8_t command, uint16_t argument)
+{
+	job->command = command;
+	job->argument = argument;
+	job->busy = true;
+	task_signal(&job->request);
+}
+
+// Loads several sounds from the asset pack at once, so that their reads can be
+// ordered by position on the disc.
+static void loadSoundsFromPack(const char *const *names, Sound *const *sounds, size_t count)
+{
+	void *data[count];
+
+	assetPack_loadMultiple(names, data, count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!data[i])
+		{
+			continue;
+		}
+
+		sound_loadSoundFromBinary(data[i], sounds[i]);
+		free(data[i]);
+	}
+}
+
+// Draws a row of blocks with a highlight sweeping across it, shown while
+// waiting for the drive.
+static void drawProgressIndicator(DMAChain *chain, int x, int y, uint32_t frame)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		uint8_t color = (i == ((frame / 4) % 8)) ? 255 : 96;
+		uint32_t *ptr = allocatePacket(chain, 3);
+		ptr[0] = gp0_rgb(color, color, color) | gp0_rectangle(false, false, false);
+		ptr[1] = gp0_xy(x + (i * 10), y);
+		ptr[2] = gp0_xy(8, 8);
+	}
+}
+
+// Reads the whole SYSTEM.CNF file from the mounted image and parses it. Keys
+// missing from the file keep the defaults already in the configuration.
+static bool loadSystemCNF(SystemCNF *config)
+{
+	CDFile file;
+
+	DEBUG_PRINT("load SYSTEM.CNF\n");
+	if (!cdfile_open(&file, "SYSTEM.CNF"))
+	{
+		return false;
+	}
+
+	size_t length = MIN(cdfile_getLength(&file), SYSTEM_CNF_MAX_LENGTH);
+	char *data = malloc(length + 1);
+	bool found = false;
+
+	if (data)
+	{
+		length = cdfile_read(&file, data, length);
+		data[length] = 0;
+		DEBUG_PRINT("SYSTEM.CNF contents = '\n%s'\n", data);
+
+		found = systemCNF_parse(config, data, length);
+		free(data);
+	}
+
+	cdfile_close(&file);
+	return found;
+}
+
+#if MENU_CD_BENCHMARK
+// Requests the first page of the root directory listing from the firmware and
+// reads it back, used to time the round trip of a listing request.
+static void requestRootListing(void *buffer)
+{
+	sendCommand(COMMAND_GOTO_ROOT, 0);
+	startCDROMRead(100, buffer, 1, 2340, true, true);
+}
+#endif
+
+#if MENU_INPUT_LATENCY
+// Prints the number of frames between a button press being sampled and the
+// first frame reflecting it being displayed, along with running statistics.
+static void logInputLatency(uint32_t latency)
+{
+	static uint32_t minLatency = ~0, maxLatency = 0, totalLatency = 0, count = 0;
+
+	minLatency = MIN(minLatency, latency);
+	maxLatency = MAX(maxLatency, latency);
+	totalLatency += latency;
+	count++;
+
+	printf(
+		"Input latency: %d frames (min %d, max %d, avg %d.%02d over %d presses)\n",
+		latency, minLatency, maxLatency, totalLatency / count,
+		(totalLatency * 100 / count) % 100, count
+	);
+}
+#endif
+
+// Checks the type of the newly mounted image, forwards the game ID to the
+// memory card if possible and boots it, either directly or by rebooting the
+// console. MCPports holds the ports that may have a memory card PicoStation
+// plugged in, which are checked again before sending the ID. This function
+// does not return.
+static void bootMountedImage(bool fastBoot, uint8_t MCPports)
+{
+	SystemCNF config;
+	bool hasFilesystem = false;
+
+	systemCNF_init(&config);
+
+	DEBUG_PRINT("Check CD type\n");
+	if (is_playstation_cd())
+	{
+		DEBUG_PRINT("is PS1 image\n");
+		hasFilesystem = !initFilesystem();
+
+		if (hasFilesystem && loadSystemCNF(&config))
+		{
+			DEBUG_PRINT("Game id: %s\n", config.boot);
+
+			uint8_t MCPpresent = MCPports ? checkMCPpresent(MCPports) : 0;
+
+			if (MCPpresent)
+			{
+				DEBUG_PRINT("Sending game id to memcard (%02X)\n", MCPpresent);
+				sendGameID(config.boot, MCPpresent);
+			}
+
+			//DEBUG_PRINT("Sending game id to picostation\n");
+			//sendCommand(COMMAND_IO_COMMAND, IO_COMMAND_GAMEID);
+			/*uint32_t len = strlen(config.boot);
+			size_t paddedLen = len + 1; 
+			for (uint32_t i = 0; i < paddedLen; i += 2)
+			{
+				delayMicroseconds(10000);
+				uint16_t pair = 0;
+				if (i < len)
+				{
+					pair |= (uint8_t)config.boot[i] << 8;
+				}
+				if (i + 1 < len)
+				{
+					pair |= (uint8_t)config.boot[i + 1];
+				}
+				sendCommand(COMMAND_IO_DATA, pair);
+			}*/
+		}
+	}
+	else
+	{
+		DEBUG_PRINT("is CDDA image\n");
+		fastBoot = false;
+	}
+
+	// Make sure no controller poll is left half-way through.
+	controller_lockBus();
+
+	cdrom_logStats();
+	stream_logStats();
+	task_logStats();
+	DEBUG_PRINT("Longest IRQ handler run: %d us\n", irq_getMaxHandlerTime());
+
+#if MENU_DIRECT_BOOT
+	// Load and start the executable without going through the BIOS boot
+	// sequence. If the image has no SYSTEM.CNF, the defaults used by the BIOS
+	// (i.e. PSX.EXE) apply. exe_boot() only returns on failure, in which case
+	// the console is rebooted as usual.
+	if (fastBoot && hasFilesystem)
+	{
+		exe_boot(config.boot, config.event, config.tcb, config.stack);
+		DEBUG_PRINT("Direct boot failed, rebooting\n");
+	}
+#endif
+
+	if (fastBoot) {
+		softFastReboot();
+	} else {
+		softReset();
+	}
+}
+
 int main(int argc, const char **argv)
 {
-	static uint8_t MCPpresent;
-	COUNTERS[1].mode = 0x0100;
+	// Memory card PicoStations are detected one port per frame once the menu is
+	// up, as the result is only needed when launching a game.
+	static uint8_t MCPpresent = 0;
+	static uint8_t MCPchecked = 0;
 
+	initTimer();
 	initIRQ();
-#if DEBUG_LOGGING_ENABLED
+#if DEBUG_LOGGING_ENABLED || MENU_CD_BENCHMARK || MENU_INPUT_LATENCY
 	initSerialIO(115200);
 #endif
 	initControllerBus();
 	initCDROM();
 	initSPU();
-	
-	MCPpresent = checkMCPpresent();
+	stream_init();
 	
 	static Sound sfx_click;
 	static Sound sfx_slide;
-	
-	sound_loadSoundFromBinary(click_sfx, &sfx_click);
-	sound_loadSoundFromBinary(slide_sfx, &sfx_slide);
-	
+	bool assetsLoaded = false;
+
 	file_manager_init();
 
 	uint8_t currentCommand = MENU_COMMAND_GOTO_ROOT;
 
 	DEBUG_PRINT("Hello from menu loader!\n");
-	DEBUG_PRINT("MC present %02X\n", MCPpresent);
 
 	if ((GPU_GP1 & GP1_STAT_FB_MODE_BITMASK) == GP1_STAT_FB_MODE_PAL)
 	{
@@ -416,24 +444,47 @@ int main(int argc, const char **argv)
 	GPU_GP1 = gp1_dmaRequestMode(GP1_DREQ_GP0_WRITE);
 	GPU_GP1 = gp1_dispBlank(false);
 
-	TextureInfo font;
-	TextureInfo logo;
+	// Upload the texture atlas generated by buildAtlas.py, which holds the font
+	// and logo along with their palettes, in a single transfer. The location of
+	// each image within the atlas is known at build time.
+	const TextureInfo logo = ATLAS_LOGO;
 
-	uploadIndexedTexture(
-		&font, fontTexture, fontPalette, SCREEN_WIDTH * 2, 0, SCREEN_WIDTH * 2,
-		FONT_HEIGHT, FONT_WIDTH, FONT_HEIGHT, FONT_COLOR_DEPTH
-	);
+	// The atlas is the only asset still embedded in the executable, as it is
+	// needed to draw the very first frame. It is stored LZ4 compressed by
+	// default (see MENU_COMPRESS_ASSETS in CMakeLists.txt) and decompressed into
+	// a temporary staging buffer, which is freed once uploaded to VRAM.
+#if DEBUG_MAIN
+	uint32_t assetStart = timer_getTicks();
+#endif
 
-	uploadIndexedTexture(
-		&logo, logoTexture, logoPalette, SCREEN_WIDTH * 2, FONT_WIDTH,
-		SCREEN_WIDTH * 2, TEXTURE_HEIGHT + (FONT_WIDTH*2), TEXTURE_WIDTH, TEXTURE_HEIGHT,
-		TEXTURE_COLOR_DEPTH
-	);
+	void *atlasData = asset_unpack(atlasTexture, 0);
+
+	if (atlasData)
+	{
+		sendVRAMData(atlasData, ATLAS_X, ATLAS_Y, ATLAS_WIDTH, ATLAS_HEIGHT);
+		waitForDMADone();
+	}
+	asset_release(atlasData, atlasTexture);
+
+#if DEBUG_MAIN
+	DEBUG_PRINT(
+		"Assets loaded in %d us, %d us since boot\n",
+		timer_ticksToMicroseconds(timer_getTicks() - assetStart),
+		timer_ticksToMicroseconds(timer_getTicks()));
+#endif
 
 	DMAChain dmaChains[2];
 	bool usingSecondFrame = false;
 
 	char sectorBuffer[2324];
+
+	static Task listingTaskState;
+	static ListingJob listingJob;
+	static uint32_t listingStack[LISTING_TASK_STACK_SIZE / 4];
+	bool listingStarted = false;
+
+	listingJob.sectorBuffer = sectorBuffer;
+	task_create(&listingTaskState, "listing", listingTask, &listingJob, listingStack, sizeof(listingStack));
 	
 	static uint8_t highlight = 0;
 	
@@ -443,7 +494,28 @@ int main(int argc, const char **argv)
 
 	int creditsmenu = 0;
 
-	uint16_t previousButtons = getButtonPress(0);
+#if MENU_CD_BENCHMARK
+	static char benchmarkReport[512];
+#endif
+
+	MOUNT_PHASE mountPhase = MOUNT_PHASE_NONE;
+	uint32_t progressFrames = 0;
+#if DEBUG_MAIN
+	uint32_t mountStart = 0;
+#endif
+
+	// Holding up or down speeds up to 64 entries per frame after about a
+	// second, enough to cross a full directory in two seconds. Page jumps
+	// speed up to 4 pages per repeat.
+	static const InputRepeatCurve listRepeat = { 16, 6, 1, 3, 64 };
+	static const InputRepeatCurve pageRepeat = { 20, 8, 4, 4, 4 };
+
+	input_init(0);
+	input_setRepeatCurve(BUTTON_MASK_UP | BUTTON_MASK_DOWN, &listRepeat);
+	input_setRepeatCurve(
+		BUTTON_MASK_LEFT | BUTTON_MASK_RIGHT | BUTTON_MASK_L1 | BUTTON_MASK_R1,
+		&pageRepeat
+	);
 
 	for (;;)
 	{
@@ -460,7 +532,7 @@ int main(int argc, const char **argv)
 		chain->nextPacket = chain->data;
 
 		ptr = allocatePacket(chain, 4);
-		ptr[0] = gp0_texpage(0, true, false);
+		ptr[0] = gp0_texpage(ATLAS_PAGE, false, false);
 		ptr[1] = gp0_fbOffset1(bufferX, bufferY);
 		ptr[2] = gp0_fbOffset2(bufferX + SCREEN_WIDTH - 1, bufferY + SCREEN_HEIGHT - 2);
 		ptr[3] = gp0_fbOrigin(bufferX, bufferY);
@@ -472,38 +544,71 @@ int main(int argc, const char **argv)
 
 		//draw logo
 		//if (firstboot == 0 && loadingmenu == 0){
-			ptr    = allocatePacket(chain, 5);
-			ptr[0] = gp0_texpage(logo.page, false, false);
-			ptr[1] = gp0_rectangle(true, true, true);
-			ptr[2] = gp0_xy(96, 10);
-			ptr[3] = gp0_uv(logo.u, logo.v, logo.clut);
-			ptr[4] = gp0_xy(logo.width, logo.height);
+			ptr    = allocatePacket(chain, 4);
+			ptr[0] = gp0_rectangle(true, true, true);
+			ptr[1] = gp0_xy(96, 10);
+			ptr[2] = gp0_uv(logo.u, logo.v, logo.clut);
+			ptr[3] = gp0_xy(logo.width, logo.height);
 		//}
 		
-		// get the controller button press
-		uint16_t buttons = getButtonPress(0);
-		uint16_t pressedButtons = ~previousButtons & buttons;
-		static uint8_t hold = 0;
-		
-		if ((buttons & BUTTON_MASK_UP) && (previousButtons & BUTTON_MASK_UP))
+		const uint16_t pageSize = 16;
+
+		// Collect the buttons pressed or repeated since the last frame, along
+		// with how far they move the selection. A single press of up or down
+		// wraps around the list, while repeats and page jumps stop at either
+		// end of it.
+		uint16_t pressedButtons = 0;
+		uint32_t pressFrame = 0;
+		int selectionMove = 0;
+		bool selectionWrap = false;
+		InputEvent event;
+
+		input_update();
+
+		while (input_getEvent(&event))
 		{
-			if (++hold > 30) {
-				pressedButtons ^= BUTTON_MASK_UP;
-				hold = 25;
+			if (event.type == INPUT_EVENT_RELEASE)
+			{
+				continue;
 			}
-		}
-		else if ((buttons & BUTTON_MASK_DOWN) && (previousButtons & BUTTON_MASK_DOWN))
-		{
-			if (++hold > 30) {
-				pressedButtons ^= BUTTON_MASK_DOWN;
-				hold = 25;
+
+			pressedButtons |= event.button;
+
+			if (event.type == INPUT_EVENT_PRESS && (!pressFrame || (int32_t)(event.time - pressFrame) < 0))
+			{
+				pressFrame = event.time;
+			}
+
+			switch (event.button)
+			{
+				case BUTTON_MASK_UP:
+					selectionMove -= event.count;
+					selectionWrap |= event.type == INPUT_EVENT_PRESS;
+					break;
+				case BUTTON_MASK_DOWN:
+					selectionMove += event.count;
+					selectionWrap |= event.type == INPUT_EVENT_PRESS;
+					break;
+				case BUTTON_MASK_LEFT:
+				case BUTTON_MASK_L1:
+					selectionMove -= pageSize * event.count;
+					break;
+				case BUTTON_MASK_RIGHT:
+				case BUTTON_MASK_R1:
+					selectionMove += pageSize * event.count;
+					break;
 			}
-		}
-		else {
-			hold = 0;
 		}
 
-		const uint16_t pageSize = 16;
+		selectionMove += input_getAnalogScroll();
+
+		// Ignore all input while a command (such as loading a listing or
+		// mounting an image) spans multiple frames.
+		if (currentCommand != MENU_COMMAND_NONE)
+		{
+			pressedButtons = 0;
+			selectionMove = 0;
+		}
 
 		if (pressedButtons & BUTTON_MASK_SELECT)
 		{
@@ -512,28 +617,23 @@ int main(int argc, const char **argv)
 
 		if (creditsmenu == 0)
 		{
-			if (pressedButtons & BUTTON_MASK_UP)
-			{
-				selectedindex = selectedindex > 0 ? selectedindex - 1 : fileEntryCount - 1;
-			}
-			else if (pressedButtons & BUTTON_MASK_DOWN)
-			{
-				selectedindex = selectedindex < (int)(fileEntryCount - 1) ? selectedindex + 1 : 0;
-			}
-			
-			if (pressedButtons & (BUTTON_MASK_LEFT | BUTTON_MASK_L1))
-			{
-				selectedindex = selectedindex >= pageSize ? selectedindex - pageSize : 0;
-			}
-			else if (pressedButtons & (BUTTON_MASK_RIGHT | BUTTON_MASK_R1))
+			if (selectionMove && fileEntryCount)
 			{
-				selectedindex = selectedindex < (int)(fileEntryCount - (pageSize + 1)) ? selectedindex + pageSize : fileEntryCount - 1;
+				int index = selectedindex + selectionMove;
+				int lastIndex = fileEntryCount - 1;
+
+				if (selectionWrap && (selectionMove == 1 || selectionMove == -1))
+				{
+					index = index < 0 ? lastIndex : (index > lastIndex ? 0 : index);
+				}
+
+				selectedindex = MAX(0, MIN(index, lastIndex));
 			}
 			
 			if (pressedButtons & (BUTTON_MASK_UP | BUTTON_MASK_DOWN | BUTTON_MASK_LEFT | BUTTON_MASK_RIGHT 
 																	| BUTTON_MASK_L1   | BUTTON_MASK_R1))
 			{
-				sound_playOnChannel(&sfx_click, SFX_VOL, SFX_VOL, 0);
+				sound_playWithPriority(&sfx_click, SFX_VOL, SFX_VOL, PRIORITY_LOW);
 			}
 
 			if (pressedButtons & BUTTON_MASK_START)
@@ -565,7 +665,7 @@ int main(int argc, const char **argv)
 			
 			if (pressedButtons & (BUTTON_MASK_SQUARE | BUTTON_MASK_X | BUTTON_MASK_START))
 			{
-				sound_playOnChannel(&sfx_slide, SFX_VOL, SFX_VOL, 1);
+				sound_playWithPriority(&sfx_slide, SFX_VOL, SFX_VOL, PRIORITY_NORMAL);
 			}
 
 			if (pressedButtons & BUTTON_MASK_TRIANGLE)
@@ -573,15 +673,27 @@ int main(int argc, const char **argv)
 				currentCommand = MENU_COMMAND_BOOTLOADER;
 			}
 
+#if MENU_CD_BENCHMARK
+			if (pressedButtons & BUTTON_MASK_L2)
+			{
+				currentCommand = MENU_COMMAND_BENCHMARK;
+			}
+#endif
+
 			if (currentCommand != MENU_COMMAND_NONE)
 			{
-				printString(chain, &font, 40, 40, "Please Wait Loading...");
+				printString(chain, 40, 40, "Please Wait Loading...");
+
+				if (mountPhase != MOUNT_PHASE_NONE || listingStarted)
+				{
+					drawProgressIndicator(chain, 40, 56, progressFrames++);
+				}
 			}
 			else
 			{
 				char fbuffer[32];
 				snprintf(fbuffer, sizeof(fbuffer), "%i of %i", selectedindex + 1, fileEntryCount);
-				printString(chain, &font, 16, 16, fbuffer);
+				printString(chain, 16, 16, fbuffer);
 
 				int32_t start = 0;
 				if ((int32_t)fileEntryCount >= pageSize)
@@ -609,147 +721,209 @@ int main(int argc, const char **argv)
 
 						char buffer[300];
 						snprintf(buffer, sizeof(buffer), "%-4d %s %s\n", index + 1, file->flag == 0 ? "\x8f" : "\x92", file->filename);
-						printString(chain, &font, 16, 34 + (i * 11), buffer);
+						printString(chain, 16, 34 + (i * 11), buffer);
 					}
 				}
 				else
 				{
-					printString(chain, &font, 40, 40, "Empty Folder");
+					printString(chain, 40, 40, "Empty Folder");
 				}
 
-				printString(chain, &font, 12, 212, "\x91 Select / Fast Boot, \x96 Regular Boot, \x90 Parent Folder");
+				printString(chain, 12, 212, "\x91 Select / Fast Boot, \x96 Regular Boot, \x90 Parent Folder");
 				
 				highlight = (highlight + 1) & 0x3F;
 			}
 		}
+#if MENU_CD_BENCHMARK
+		else if (creditsmenu == 2)
+		{
+			printString(chain, 16, 40, "CD-ROM benchmark (SELECT to exit)");
+			printString(chain, 16, 60, benchmarkReport);
+		}
+#endif
 		else
 		{
 			printString(
-				chain, &font, 40, 40,
+				chain, 40, 40,
 				"PicosSation Menu Alpha Release");
 			printString(
-				chain, &font, 40, 80,
+				chain, 40, 80,
 				"Huge thanks to Rama, Skitchin, Raijin, SpicyJpeg,\nDanhans42, NicholasNoble and ChatGPT");
 
 			printString(
-				chain, &font, 40, 120,
+				chain, 40, 120,
 				"https://github.com/megavolt85/picostation-menu");
 		}
 
 
-		previousButtons = buttons;
 		*(chain->nextPacket) = gp0_endTag(0);
 		waitForGP0Ready();
 		waitForVblank();
 		sendLinkedList(chain->data);
 
+#if MENU_INPUT_LATENCY
+		// The frame reflecting a press is scanned out starting from the vblank
+		// just waited for.
+		if (pressFrame && mountPhase == MOUNT_PHASE_NONE)
+		{
+			logInputLatency(irq_getFrameCount() - pressFrame);
+		}
+#endif
+
 		if (currentCommand != MENU_COMMAND_NONE)
 		{
-			if (currentCommand == MENU_COMMAND_GOTO_ROOT)
+			// Music refills must not hold up any command using the drive, so
+			// whatever is being read is dropped and read again afterwards.
+			if (mountPhase == MOUNT_PHASE_NONE && !listingStarted)
 			{
-				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_ROOT, 0);
+				stream_yield();
 			}
-			else if (currentCommand == MENU_COMMAND_GOTO_PARENT)
+
+			if ((currentCommand == MENU_COMMAND_GOTO_ROOT) || (currentCommand == MENU_COMMAND_GOTO_PARENT) || (currentCommand == MENU_COMMAND_GOTO_DIRECTORY))
 			{
-				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_PARENT, 0);
-				selectedindex = 0;
+				if (!listingStarted)
+				{
+					if (currentCommand == MENU_COMMAND_GOTO_ROOT)
+					{
+						startListing(&listingJob, COMMAND_GOTO_ROOT, 0);
+					}
+					else if (currentCommand == MENU_COMMAND_GOTO_PARENT)
+					{
+						startListing(&listingJob, COMMAND_GOTO_PARENT, 0);
+					}
+					else
+					{
+						startListing(&listingJob, COMMAND_GOTO_DIRECTORY, file_manager_get_file_index(selectedindex));
+					}
+					listingStarted = true;
+				}
+				else if (!listingJob.busy)
+				{
+					fileEntryCount = listingJob.fileEntryCount;
+					if (currentCommand != MENU_COMMAND_GOTO_ROOT)
+					{
+						selectedindex = 0;
+					}
+					listingStarted = false;
+				}
 			}
 			else if (currentCommand == MENU_COMMAND_BOOTLOADER)
 			{
 				// sendCommand(COMMAND_BOOTLOADER, 0xBEEF);
 			}
-			else if (currentCommand == MENU_COMMAND_GOTO_DIRECTORY)
+#if MENU_CD_BENCHMARK
+			else if (currentCommand == MENU_COMMAND_BENCHMARK)
 			{
-				uint16_t index = file_manager_get_file_index(selectedindex);
-				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_DIRECTORY, index);
+				CDBenchmarkResults results;
+				stream_pause();
+				cdBenchmark_run(&results, requestRootListing);
+				cdBenchmark_format(&results, benchmarkReport, sizeof(benchmarkReport));
+				printf("CD-ROM benchmark results:\n%s", benchmarkReport);
+
+				// The listing test leaves the firmware in the root directory,
+				// so the browser has to follow.
+				fileEntryCount = list_load(sectorBuffer, COMMAND_GOTO_ROOT, 0);
 				selectedindex = 0;
+				creditsmenu = 2;
+				stream_play(MUSIC_VOL, MUSIC_VOL);
 			}
+#endif
 			else if ((currentCommand == MENU_COMMAND_MOUNT_FILE_FAST) || (currentCommand == MENU_COMMAND_MOUNT_FILE_SLOW))
 			{
-				DEBUG_PRINT("DEBUG: selectedindex :%d\n", selectedindex);
-
-				uint16_t index = file_manager_get_file_index(selectedindex);
-				DEBUG_PRINT("Mount image\n");
-				sendCommand(COMMAND_MOUNT_FILE, index);
-				delayMicroseconds(400000);
-				DEBUG_PRINT("Update TOC\n");
-				updateCDROM_TOC();
-				delayMicroseconds(400000);
-				DEBUG_PRINT("Check CD type\n");
-				if (is_playstation_cd())
+				if (mountPhase == MOUNT_PHASE_NONE)
 				{
-					DEBUG_PRINT("is PS1 image\n");
-					if (MCPpresent && !initFilesystem())
-					{
-						char gameId[2048];
-						strcpy(gameId, "cdrom:\\PS.EXE;1");
+					DEBUG_PRINT("DEBUG: selectedindex :%d\n", selectedindex);
+
+					uint16_t index = file_manager_get_file_index(selectedindex);
+					DEBUG_PRINT("Mount image\n");
+					// The menu disc goes away once the image is mounted, so
+					// the music is stopped for good.
+					stream_pause();
+					sendCommand(COMMAND_MOUNT_FILE, index);
+					sectorCache_invalidate();
+#if DEBUG_MAIN
+					mountStart = timer_getTicks();
+#endif
 
-						char configBuffer[2048];
-						DEBUG_PRINT("load SYSTEM.CNF\n");
-						if (file_load("SYSTEM.CNF;1", configBuffer) == 0)
-						{
-							DEBUG_PRINT("SYSTEM.CNF contents = '\n%s'\n", configBuffer);
-
-							int i = 0;
-							int j = 0;
-							char tempBuffer[500];
-							memset(tempBuffer, 0, 500);
-							while (configBuffer[i] != '\0' && configBuffer[i] != '\n' && i < 499) 
-							{
-								if (configBuffer[i] != ' ' && configBuffer[i] != '\t') 
-								{ 
-									tempBuffer[j] = configBuffer[i]; 
-									j++;
-								}
-								i++; 
-							}
-
-							char* gameId = tempBuffer;
-							if (strncmp(tempBuffer, "BOOT=", 5) == 0)
-							{
-								gameId = tempBuffer + 5;
-							}
-
-							DEBUG_PRINT("Game id: %s\n", gameId);
-
-							DEBUG_PRINT("Sending game id to memcard (%02X)\n", MCPpresent);
-							sendGameID(gameId, MCPpresent);
-
-							//DEBUG_PRINT("Sending game id to picostation\n");
-							//sendCommand(COMMAND_IO_COMMAND, IO_COMMAND_GAMEID);
-							/*uint32_t len = strlen(gameId);
-							size_t paddedLen = len + 1; 
-							for (uint32_t i = 0; i < paddedLen; i += 2)
-							{
-								delayMicroseconds(10000);
-								uint16_t pair = 0;
-								if (i < len)
-								{
-									pair |= (uint8_t)gameId[i] << 8;
-								}
-								if (i + 1 < len)
-								{
-									pair |= (uint8_t)gameId[i + 1];
-								}
-								sendCommand(COMMAND_IO_DATA, pair);
-							}*/
-						}
-					}
+					// Rather than waiting a fixed amount of time, keep drawing
+					// frames and poll the drive until the new image is readable.
+					cdrom_startDiscPoll(CDROM_MOUNT_TIMEOUT);
+					mountPhase = MOUNT_PHASE_WAIT_IMAGE;
 				}
-				else
+				else if (cdrom_pollDisc() != CDROM_DISC_POLLING)
 				{
-					DEBUG_PRINT("is CDDA image\n");
-					currentCommand = MENU_COMMAND_MOUNT_FILE_SLOW;
+					if (mountPhase == MOUNT_PHASE_WAIT_IMAGE)
+					{
+						DEBUG_PRINT("Update TOC\n");
+						updateCDROM_TOC();
+						cdrom_startDiscPoll(CDROM_MOUNT_TIMEOUT);
+						mountPhase = MOUNT_PHASE_WAIT_TOC;
+					}
+					else
+					{
+#if DEBUG_MAIN
+						DEBUG_PRINT(
+							"Image ready in %d us\n",
+							timer_ticksToMicroseconds(timer_getTicks() - mountStart));
+#endif
+						// Ports not checked yet are checked now.
+						bootMountedImage(
+							currentCommand == MENU_COMMAND_MOUNT_FILE_FAST,
+							MCPpresent | (~MCPchecked & 3));
+					}
 				}
+			}
 
-				if (currentCommand == MENU_COMMAND_MOUNT_FILE_FAST) {
-					softFastReboot();
-				} else {
-					softReset();
-				}
+			if (mountPhase == MOUNT_PHASE_NONE && !listingStarted)
+			{
+				currentCommand = MENU_COMMAND_NONE;
 			}
+		}
+		else if (!assetsLoaded)
+		{
+			// Optional assets are only loaded from PICO.DAT once the initial
+			// listing is on screen, so they do not delay booting into the menu.
+			assetsLoaded = true;
+			bool hasFilesystem = !initFilesystem();
 
-			currentCommand = MENU_COMMAND_NONE;
+			if (hasFilesystem && assetPack_open("PICO.DAT;1"))
+			{
+				static const char *const soundNames[] = { "click", "slide" };
+				Sound *const sounds[] = { &sfx_click, &sfx_slide };
+
+				loadSoundsFromPack(soundNames, sounds, 2);
+				spuLogHeap();
+			}
+			else
+			{
+				DEBUG_PRINT("Asset pack not available, sounds disabled\n");
+			}
+
+			// Background music is streamed from an optional interleaved VAG
+			// file. Only its header is read here, and playback starts once
+			// stream_update() has buffered enough of it.
+			if (hasFilesystem && !stream_loadSong("MUSIC.VAG;1"))
+			{
+				stream_play(MUSIC_VOL, MUSIC_VOL);
+			}
+		}
+		else if (MCPchecked != 3)
+		{
+			uint8_t port = (MCPchecked & 1) ? 2 : 1;
+
+			MCPpresent |= checkMCPpresent(port);
+			MCPchecked |= port;
+
+			if (MCPchecked == 3)
+			{
+				DEBUG_PRINT("MC present %02X\n", MCPpresent);
+			}
+		}
+
+		// The music is only refilled while no command is using the drive.
+		if (currentCommand == MENU_COMMAND_NONE)
+		{
+			stream_update();
 		}
 	}
 
@@ -0,0 +1,215 @@
+#include "cdfile.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cdrom.h"
+#include "filesystem.h"
+#include "system.h"
+#include "task.h"
+#include "timer.h"
+#include "../logging.h"
+
+#if DEBUG_FS
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+static uint32_t _getNumSectors(const CDFile *file){
+    return (file->length + CDFILE_SECTOR_SIZE - 1) / CDFILE_SECTOR_SIZE;
+}
+
+static uint8_t *_getSlot(CDFile *file, uint32_t sector){
+    return &file->buffer[(sector % CDFILE_BUFFER_SECTORS) * CDFILE_SECTOR_SIZE];
+}
+
+// Credits any sectors transferred by the prefetch in progress. Once the read
+// has completed (or has been superseded by another one) it is retired.
+static void _updatePrefetch(CDFile *file){
+    if (!file->readCount)
+        return;
+
+    size_t remaining = cdrom_getReadRemaining(file->readId);
+
+    // If the read is too old to know how far it got, none of its data can be
+    // trusted.
+    if (remaining == CDROM_READ_UNKNOWN)
+        remaining = file->readCount;
+
+    file->numValid = file->readStart - file->firstSector + file->readCount - remaining;
+
+    if (!remaining || (file->readId != cdrom_getReadId()))
+        file->readCount = 0;
+}
+
+// Starts reading as many sectors as possible into the free part of the
+// buffer. Reads never wrap around the end of the buffer, as sectors are
+// transferred to consecutive addresses. Nothing is done if any read (including
+// one issued by other code) is already in progress, or if the buffer still
+// holds data and less than half of it is free, so that the drive is not asked
+// to seek for every single sector consumed.
+static void _startPrefetch(CDFile *file){
+    if (file->readCount || cdrom_getReadRemaining(cdrom_getReadId()))
+        return;
+
+    uint32_t next  = file->firstSector + file->numValid;
+    uint32_t count = CDFILE_BUFFER_SECTORS - file->numValid;
+
+    if (file->numValid && (count < (CDFILE_BUFFER_SECTORS / 2)))
+        return;
+
+    count = min(count, CDFILE_BUFFER_SECTORS - (next % CDFILE_BUFFER_SECTORS));
+    count = min(count, _getNumSectors(file) - min(next, _getNumSectors(file)));
+
+    if (!count)
+        return;
+
+    startCDROMRead(
+        file->lba + next, _getSlot(file, next), count, CDFILE_SECTOR_SIZE, true,
+        false
+    );
+
+    file->readStart = next;
+    file->readCount = count;
+    file->readId    = cdrom_getReadId();
+}
+
+// Blocks until the given sector has been transferred or the prefetch stalls.
+static bool _waitForSector(CDFile *file, uint32_t sector){
+    uint32_t numValid = file->numValid;
+    uint32_t deadline = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+
+    for (;;){
+        _updatePrefetch(file);
+
+        if (sector < (file->firstSector + file->numValid))
+            return true;
+        if (!file->readCount)
+            return false;
+
+        if (numValid != file->numValid){
+            numValid = file->numValid;
+            deadline = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+        } else if (timer_isDeadlinePassed(deadline)){
+            return false;
+        }
+
+        task_yield();
+    }
+}
+
+// Makes sure the given sector is in the buffer, discarding all sectors before
+// it to make room for prefetching.
+static bool _loadSector(CDFile *file, uint32_t sector){
+    _updatePrefetch(file);
+
+    uint32_t end = file->firstSector + file->numValid + file->readCount;
+
+    if ((sector < file->firstSector) || (sector >= end)){
+        // The sector is neither buffered nor being read (i.e. the caller
+        // seeked away), so drop everything and start over from it.
+        if (file->readCount)
+            cdrom_cancelRead();
+
+        file->firstSector = sector;
+        file->numValid    = 0;
+        file->readCount   = 0;
+    } else {
+        // Drop sectors the caller has moved past, but never past the ones
+        // that are still being read, as the prefetch writes right after them.
+        uint32_t drop = min(sector, file->firstSector + file->numValid) - file->firstSector;
+
+        file->firstSector += drop;
+        file->numValid    -= drop;
+    }
+
+    _startPrefetch(file);
+
+    if (_waitForSector(file, sector))
+        return true;
+
+    // Fall back to a blocking read, which is retried on errors.
+    DEBUG_PRINT("Prefetch of sector %d failed, retrying\n", sector);
+
+    file->firstSector = sector;
+    file->numValid    = 0;
+    file->readCount   = 0;
+
+    if (!startCDROMRead(
+        file->lba + sector, _getSlot(file, sector), 1, CDFILE_SECTOR_SIZE, true,
+        true
+    ))
+        return false;
+
+    file->numValid = 1;
+    return true;
+}
+
+bool cdfile_open(CDFile *file, const char *path){
+    DirectoryEntry entry;
+
+    if (!resolvePath(path, &entry)){
+        DEBUG_PRINT("File %s not found\n", path);
+        return false;
+    }
+
+    file->buffer = malloc(CDFILE_BUFFER_SECTORS * CDFILE_SECTOR_SIZE);
+
+    if (!file->buffer)
+        return false;
+
+    file->lba         = entry.lba;
+    file->length      = entry.length;
+    file->position    = 0;
+    file->firstSector = 0;
+    file->numValid    = 0;
+    file->readCount   = 0;
+
+    _startPrefetch(file);
+    return true;
+}
+
+size_t cdfile_read(CDFile *file, void *output, size_t length){
+    uint8_t *ptr = output;
+
+    length = min(length, file->length - file->position);
+
+    while (length){
+        uint32_t sector = file->position / CDFILE_SECTOR_SIZE;
+        uint32_t offset = file->position % CDFILE_SECTOR_SIZE;
+        size_t   chunk  = min(length, CDFILE_SECTOR_SIZE - offset);
+
+        if (!_loadSector(file, sector))
+            break;
+
+        __builtin_memcpy(ptr, _getSlot(file, sector) + offset, chunk);
+
+        ptr            += chunk;
+        length         -= chunk;
+        file->position += chunk;
+    }
+
+    // Keep the drive busy while the caller processes the data.
+    _updatePrefetch(file);
+    _startPrefetch(file);
+
+    return ptr - (uint8_t *) output;
+}
+
+void cdfile_seek(CDFile *file, uint32_t offset){
+    file->position = min(offset, file->length);
+}
+
+void cdfile_close(CDFile *file){
+    // The buffer must not be freed while the drive is still writing to it.
+    _updatePrefetch(file);
+
+    if (file->readCount)
+        cdrom_cancelRead();
+
+    free(file->buffer);
+    file->buffer = NULL;
+}
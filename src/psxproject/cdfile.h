@@ -0,0 +1,70 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of sectors buffered by each open file. While the caller consumes
+// data, the reader keeps the drive busy filling the rest of the buffer using
+// multi-sector reads, so sequential reads run at the drive's full speed.
+#define CDFILE_BUFFER_SECTORS 8
+#define CDFILE_SECTOR_SIZE    2048
+
+typedef struct {
+    uint32_t lba, length, position;
+    uint8_t  *buffer;
+
+    // File sectors [firstSector, firstSector + numValid) are in the buffer,
+    // each one in slot (sector % CDFILE_BUFFER_SECTORS). If readCount is not
+    // zero, a read of readCount sectors starting from readStart (which always
+    // follows the valid ones) is in progress.
+    uint32_t firstSector, numValid;
+    uint32_t readStart, readCount, readId;
+} CDFile;
+
+/**
+ * @brief Opens a file for reading and starts prefetching its first sectors.
+ * initFilesystem() must have been called beforehand.
+ *
+ * @param file
+ * @param path Any path accepted by resolvePath()
+ * @return True if the file was found and its buffer allocated, false otherwise
+ */
+bool cdfile_open(CDFile *file, const char *path);
+
+/**
+ * @brief Reads data from the current position, blocking until it is available
+ * and starting a new prefetch after each consumed sector. Sectors that could
+ * not be prefetched are read again with retries.
+ *
+ * @param file
+ * @param output
+ * @param length
+ * @return Number of bytes actually read (less than length at the end of the
+ * file or on an unrecoverable read error)
+ */
+size_t cdfile_read(CDFile *file, void *output, size_t length);
+
+/**
+ * @brief Moves the current position. Buffered data is kept if the new position
+ * falls within it.
+ *
+ * @param file
+ * @param offset Offset from the beginning of the file, clamped to its length
+ */
+void cdfile_seek(CDFile *file, uint32_t offset);
+
+/**
+ * @brief Cancels any prefetch still in progress, then releases the file's
+ * buffer.
+ *
+ * @param file
+ */
+void cdfile_close(CDFile *file);
+
+static inline uint32_t cdfile_getLength(const CDFile *file){
+    return file->length;
+}
+
+static inline uint32_t cdfile_tell(const CDFile *file){
+    return file->position;
+}
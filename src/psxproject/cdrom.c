@@ -6,11 +6,16 @@
 
 #include "ps1/registers.h"
 #include "filesystem.h"
+#include "irq.h"
+#include "sectorcache.h"
+#include "task.h"
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdatomic.h>
 #include "delay.h"
+#include "system.h"
+#include "timer.h"
 #include "../logging.h"
 
 #if DEBUG_CDROM
@@ -31,12 +36,70 @@ void  *cdromReadDataPtr;
 size_t cdromReadDataSectorSize;
 volatile size_t cdromReadDataNumSectors;
 
+// Reads started by cdrom_startRingRead() wrap around to the beginning of the
+// buffer once they reach its end. NULL for all other reads.
+static void *cdromReadRingStart = NULL;
+static void *cdromReadRingEnd   = NULL;
+
 uint8_t cdromResponse[16];
 uint8_t cdromRespLength;
 uint8_t cdromStatus;
 
 uint8_t cdromLastReadPurpose;
 
+CDROMCommandStats cdromStats[CDROM_STATS_COMMANDS];
+
+static uint8_t  cdromLastCommand     = 0;
+static uint32_t cdromCommandDeadline = 0;
+
+static CDROMCommandStats *_getStats(uint8_t cmd) {
+    return &cdromStats[(cmd < CDROM_STATS_COMMANDS) ? cmd : 0];
+}
+
+/* Waiting */
+
+typedef bool (*CDROMWaitCondition)(void);
+
+// Spins until the given condition is met or the timeout (in microseconds)
+// expires. All waits on the drive go through this function, so that a dropped
+// interrupt can never hang the system. If yield is set, other tasks are run
+// while waiting.
+static bool _waitUntil(CDROMWaitCondition condition, uint32_t timeout, bool yield) {
+    uint32_t deadline = timer_getDeadline(timeout);
+
+    while (!condition()) {
+        if (timer_isDeadlinePassed(deadline))
+            return condition();
+        if (yield)
+            task_yield();
+    }
+
+    return true;
+}
+
+static bool _isNotBusy(void) {
+    return !CDROM_BUSY;
+}
+static bool _isInt1Received(void) {
+    return !waitingForInt1 || !waitingForInt5;
+}
+static bool _isInt2Received(void) {
+    return !waitingForInt2 || !waitingForInt5;
+}
+static bool _isInt3Received(void) {
+    return !waitingForInt3 || !waitingForInt5;
+}
+
+static bool _waitForResponse(CDROMWaitCondition condition, uint32_t timeout) {
+    if (!_waitUntil(condition, timeout, true)) {
+        DEBUG_PRINT("Command %02x timed out\n", cdromLastCommand);
+        _getStats(cdromLastCommand)->timeouts++;
+        return false;
+    }
+
+    return waitingForInt5;
+}
+
 #define toBCD(i) (((i) / 10 * 16) | ((i) % 10))
 
 #define CDROM_BUSY (CDROM_HSTS & CDROM_HSTS_BUSYSTS)
@@ -68,70 +131,470 @@ void initCDROM(void) {
     CDROM_ADPCTL = CDROM_ADPCTL_CHNGATV;
 }
 
-void issueCDROMCommand(uint8_t cmd, const uint8_t *arg, size_t argLength) {
+/* Command queue */
+
+typedef struct {
+    uint8_t       cmd, argLength;
+    uint8_t       arg[CDROM_MAX_ARGS];
+    CDROMCallback callback;
+    void          *callbackArg;
+} CDROMQueueEntry;
+
+static CDROMQueueEntry cdromQueue[CDROM_QUEUE_LENGTH];
+static int16_t         cdromQueueResults[CDROM_QUEUE_LENGTH];
+
+// First two bytes of the error response (INT5) of each command that failed.
+// Some commands, such as GetID, report more than just an error this way.
+static uint8_t cdromQueueErrors[CDROM_QUEUE_LENGTH][2];
+
+// The queue holds all tickets in the (lastCompletedTicket, nextTicket) range;
+// the oldest one is sent to the drive as soon as the previous one completes and
+// cdromQueueBusy is set until its response arrives.
+static volatile CDROMTicket nextTicket          = 1;
+static volatile CDROMTicket lastCompletedTicket = 0;
+static volatile bool        cdromQueueBusy      = false;
+
+// Callbacks are run in ticket order; all tickets up to lastCallbackTicket have
+// had theirs run (or had none) and their queue entries can be reused.
+static volatile CDROMTicket lastCallbackTicket = 0;
+
+// Set while a call to _deferredIssue() or _deferredCallbacks() is queued, so
+// that completing several commands before the deferred work runs only queues it
+// once. If the deferred work queue is full neither is set, and _pollQueue()
+// picks up the work instead.
+static volatile bool cdromIssueDeferred    = false;
+static volatile bool cdromCallbackDeferred = false;
+static bool          cdromRunningCallbacks = false;
+
+// Returns whether a command needs a second response (INT2) to complete, rather
+// than just the acknowledge (INT3).
+static bool _hasSecondResponse(uint8_t cmd) {
+    switch (cmd) {
+        case CDROM_CMD_STANDBY:
+        case CDROM_CMD_STOP:
+        case CDROM_CMD_PAUSE:
+        case CDROM_CMD_INIT:
+        case CDROM_CMD_SETSESSION:
+        case CDROM_CMD_SEEK_L:
+        case CDROM_CMD_SEEK_P:
+        case CDROM_CMD_GET_ID:
+        case CDROM_CMD_READ_TOC:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool _hasPendingCommand(void) {
+    return !cdromQueueBusy && ((nextTicket - lastCompletedTicket) > 1);
+}
+
+// Sends the oldest queued command to the drive, if any. Must be called with
+// interrupts disabled, after waiting for the drive to become ready.
+static void _issueNextCommand(void) {
+    if (!_hasPendingCommand())
+        return;
+
+    const CDROMQueueEntry *entry =
+        &cdromQueue[(lastCompletedTicket + 1) % CDROM_QUEUE_LENGTH];
+
     waitingForInt1 = true;
     waitingForInt2 = true;
     waitingForInt3 = true;
     waitingForInt4 = true;
     waitingForInt5 = true;
-	cdromStatus = 0;
+    cdromStatus = 0;
     cdromDataReady = false;
+    cdromQueueBusy = true;
+    cdromLastCommand = entry->cmd;
 
-    while (CDROM_BUSY)
-        __asm__ volatile("");
-    
-    CDROM_ADDRESS = 1;
-    CDROM_HCLRCTL = CDROM_HCLRCTL_CLRPRM; // Clear parameter buffer
-    delayMicroseconds(100);
-    int time = 102;
-    __asm__ volatile(
-        // The .set noreorder directive will prevent the assembler from trying
-        // to "hide" the branch instruction's delay slot by shuffling nearby
-        // instructions. .set push and .set pop are used to save and restore the
-        // assembler's settings respectively, ensuring the noreorder flag will
-        // not affect any other code.
-        ".set push\n"
-        ".set noreorder\n"
-        "bgtz  %0, .\n"
-        "addiu %0, -2\n"
-        ".set pop\n"
-        : "+r"(time)
+    cdromCommandDeadline = timer_getDeadline(
+        _hasSecondResponse(entry->cmd) ? CDROM_COMPLETE_TIMEOUT : CDROM_ACK_TIMEOUT
     );
 
-    while (CDROM_BUSY)
-        __asm__ volatile("");
+    CDROM_ADDRESS = 1;
+    CDROM_HCLRCTL = CDROM_HCLRCTL_CLRPRM; // Clear parameter buffer
 
     CDROM_ADDRESS = 0;
-    for (; argLength > 0; argLength--)
-        CDROM_PARAMETER = *(arg++);
-    
-    CDROM_COMMAND = cmd;
+    for (size_t i = 0; i < entry->argLength; i++)
+        CDROM_PARAMETER = entry->arg[i];
+
+    CDROM_COMMAND = entry->cmd;
 }
 
-void waitForINT1(){
-    while(waitingForInt1 && waitingForInt5){
-        __asm__ volatile("");
+// Sends the next queued command, if any, once the drive is ready. Must not be
+// called from an IRQ handler, as the drive may take a while to become ready.
+static void _issuePendingCommand(void) {
+    if (!_hasPendingCommand())
+        return;
+
+    // The drive only stays busy for a few microseconds after the previous
+    // command has been acknowledged. If it does not become ready the command
+    // is sent anyway and will eventually time out. Nothing else can send a
+    // command in the meantime, as IRQ handlers always defer it (and no other
+    // task gets to run, as this wait does not yield).
+    if (!_waitUntil(_isNotBusy, CDROM_BUSY_TIMEOUT, false))
+        _getStats(
+            cdromQueue[(lastCompletedTicket + 1) % CDROM_QUEUE_LENGTH].cmd
+        )->timeouts++;
+
+    bool enable = disableInterrupts();
+
+    _issueNextCommand();
+
+    if (enable)
+        enableInterrupts();
+}
+
+static void _deferredIssue(void *arg) {
+    cdromIssueDeferred = false;
+    _issuePendingCommand();
+}
+
+// Runs the callbacks of all completed commands that have not had theirs run
+// yet, in order. Must not be called from an IRQ handler.
+static void _runCallbacks(void) {
+    // Callbacks may poll the queue themselves, which must not run the same
+    // callback twice.
+    if (cdromRunningCallbacks)
+        return;
+
+    cdromRunningCallbacks = true;
+
+    for (;;) {
+        bool enable = disableInterrupts();
+
+        if (lastCallbackTicket == lastCompletedTicket) {
+            if (enable)
+                enableInterrupts();
+            break;
+        }
+
+        CDROMTicket           ticket = lastCallbackTicket + 1;
+        const CDROMQueueEntry *entry = &cdromQueue[ticket % CDROM_QUEUE_LENGTH];
+
+        CDROMCallback callback = entry->callback;
+        void          *arg     = entry->callbackArg;
+        int           result   = cdromQueueResults[ticket % CDROM_QUEUE_LENGTH];
+
+        lastCallbackTicket = ticket;
+
+        if (enable)
+            enableInterrupts();
+
+        if (callback)
+            callback(result, arg);
     }
+
+    cdromRunningCallbacks = false;
+}
+
+static void _deferredCallbacks(void *arg) {
+    cdromCallbackDeferred = false;
+    _runCallbacks();
 }
 
-void waitForINT2(){
-    while(waitingForInt2 && waitingForInt5){
-        __asm__ volatile("");
+// Queues sending the next command, so that it happens outside of interrupt
+// context. Must be called with interrupts disabled.
+static void _deferIssue(void) {
+    if (!cdromIssueDeferred)
+        cdromIssueDeferred = irq_defer(_deferredIssue, NULL);
+}
+
+// Completes the command currently being processed with the given result and
+// queues sending the next one, as well as the command's callback. Must be
+// called with interrupts disabled.
+static void _completeCommand(int result) {
+    CDROMTicket     ticket = lastCompletedTicket + 1;
+    CDROMQueueEntry *entry = &cdromQueue[ticket % CDROM_QUEUE_LENGTH];
+
+    cdromQueueResults[ticket % CDROM_QUEUE_LENGTH] = result;
+    lastCompletedTicket = ticket;
+    cdromQueueBusy = false;
+
+    if (!entry->callback && (lastCallbackTicket == (ticket - 1)))
+        lastCallbackTicket = ticket;
+    else if (!cdromCallbackDeferred)
+        cdromCallbackDeferred = irq_defer(_deferredCallbacks, NULL);
+
+    _deferIssue();
+}
+
+// Called from the IRQ handler when a response is received. Responses that do
+// not complete the command currently being processed are ignored.
+static void _handleCommandResponse(uint8_t irqType) {
+    if (!cdromQueueBusy)
+        return;
+
+    uint8_t cmd = cdromQueue[(lastCompletedTicket + 1) % CDROM_QUEUE_LENGTH].cmd;
+
+    if (irqType == CDROM_IRQ_ERROR) {
+        uint8_t *error = cdromQueueErrors[(lastCompletedTicket + 1) % CDROM_QUEUE_LENGTH];
+
+        error[0] = cdromResponse[0];
+        error[1] = cdromResponse[1];
+        _completeCommand(CDROM_RESULT_ERROR);
     }
+    else if ((irqType == CDROM_IRQ_COMPLETE) || !_hasSecondResponse(cmd))
+        _completeCommand(cdromResponse[0]);
 }
 
-void waitForINT3(){
-    while(waitingForInt3 && waitingForInt5){
-        __asm__ volatile("");
+// Runs any work deferred by the IRQ handler (i.e. sending the next command and
+// running callbacks) and fails the command currently being processed if no
+// response was received before its deadline, so that a dropped interrupt does
+// not stall the queue.
+static void _pollQueue(void) {
+    irq_runDeferred();
+
+    if (cdromQueueBusy) {
+        bool enable = disableInterrupts();
+
+        if (cdromQueueBusy && timer_isDeadlinePassed(cdromCommandDeadline)) {
+            DEBUG_PRINT("Command %02x timed out\n", cdromLastCommand);
+            _getStats(cdromLastCommand)->timeouts++;
+            _completeCommand(CDROM_RESULT_TIMEOUT);
+        }
+
+        if (enable)
+            enableInterrupts();
+
+        irq_runDeferred();
     }
+
+    // If the deferred work queue was full when a command completed, its
+    // callback and the next command were never queued. Both calls do nothing
+    // if there is nothing left to do.
+    _runCallbacks();
+    _issuePendingCommand();
 }
 
-void waitForINT5(){
-    while(waitingForInt5){
-        __asm__ volatile("");
+// Adds a command to the queue without sending it. Safe to call from IRQ
+// handlers.
+static CDROMTicket _enqueueCommand(
+    uint8_t cmd, const uint8_t *arg, size_t argLength, CDROMCallback callback,
+    void *callbackArg
+) {
+    if (argLength > CDROM_MAX_ARGS)
+        return 0;
+
+    bool enable = disableInterrupts();
+
+    // Entries are only freed once their callback has run, as it reads the
+    // callback and its argument from the queue.
+    if ((nextTicket - lastCallbackTicket) > CDROM_QUEUE_LENGTH) {
+        if (enable)
+            enableInterrupts();
+
+        return 0;
     }
+
+    CDROMTicket     ticket = nextTicket++;
+    CDROMQueueEntry *entry = &cdromQueue[ticket % CDROM_QUEUE_LENGTH];
+
+    entry->cmd         = cmd;
+    entry->argLength   = argLength;
+    entry->callback    = callback;
+    entry->callbackArg = callbackArg;
+    __builtin_memcpy(entry->arg, arg, argLength);
+
+    if (enable)
+        enableInterrupts();
+
+    return ticket;
+}
+
+CDROMTicket cdrom_submitCommand(
+    uint8_t cmd, const uint8_t *arg, size_t argLength, CDROMCallback callback,
+    void *callbackArg
+) {
+    CDROMTicket ticket =
+        _enqueueCommand(cmd, arg, argLength, callback, callbackArg);
+
+    if (ticket)
+        _issuePendingCommand();
+
+    return ticket;
+}
+
+bool cdrom_isCommandDone(CDROMTicket ticket) {
+    _pollQueue();
+    return ((int32_t) (lastCompletedTicket - ticket)) >= 0;
+}
+
+int cdrom_waitForCommand(CDROMTicket ticket) {
+    while (!cdrom_isCommandDone(ticket))
+        task_yield();
+
+    return cdromQueueResults[ticket % CDROM_QUEUE_LENGTH];
+}
+
+bool cdrom_isQueueIdle(void) {
+    _pollQueue();
+    return (nextTicket - lastCompletedTicket) <= 1;
+}
+
+// Submits a command, spinning until there is room in the queue.
+static CDROMTicket _submitCommandBlocking(
+    uint8_t cmd, const uint8_t *arg, size_t argLength
+) {
+    CDROMTicket ticket;
+
+    while (!(ticket = cdrom_submitCommand(cmd, arg, argLength, NULL, NULL)))
+        _pollQueue();
+
+    return ticket;
+}
+
+void issueCDROMCommand(uint8_t cmd, const uint8_t *arg, size_t argLength) {
+    CDROMTicket ticket = _submitCommandBlocking(cmd, arg, argLength);
+
+    // Wait until the command has actually been sent (i.e. it is the one being
+    // processed or it has completed already), as the waitingForIntN flags are
+    // only reset at that point.
+    while (
+        !cdrom_isCommandDone(ticket) &&
+        !(cdromQueueBusy && ((lastCompletedTicket + 1) == ticket))
+    )
+        task_yield();
+}
+
+bool waitForINT1(void){
+    return _waitForResponse(_isInt1Received, CDROM_SECTOR_TIMEOUT);
 }
 
+bool waitForINT2(void){
+    return _waitForResponse(_isInt2Received, CDROM_COMPLETE_TIMEOUT);
+}
+
+bool waitForINT3(void){
+    return _waitForResponse(_isInt3Received, CDROM_ACK_TIMEOUT);
+}
+
+// Queues a SetMode/SetLoc/ReadN sequence and, if wait is set, waits until all
+// sectors have been transferred into cdromReadDataPtr. Each command is sent by
+// the IRQ handler as soon as the previous one is acknowledged.
+static bool _readSectors(uint32_t lba, uint8_t mode, bool wait) {
+    CDROMMSF msf;
+
+    cdrom_convertLBAToMSF(&msf, lba);
+
+    //DEBUG_PRINT("LBA Set: %d (%02x:%02x:%02x), issue setmode\n", lba, msf.minute, msf.second, msf.frame);
+    _submitCommandBlocking(CDROM_CMD_SETMODE, &mode, sizeof(mode));
+    CDROMTicket setlocTicket = _submitCommandBlocking(
+        CDROM_CMD_SETLOC, (const uint8_t *)&msf, sizeof(msf)
+    );
+    CDROMTicket readTicket = _submitCommandBlocking(CDROM_CMD_READ_N, NULL, 0);
+
+    if (!wait)
+        return true;
+    if ((cdrom_waitForCommand(setlocTicket) < 0) || (cdrom_waitForCommand(readTicket) < 0))
+        return false;
+
+    // The deadline is pushed back every time a sector arrives, so only a stall
+    // (rather than a long read) counts as a timeout.
+    size_t   remaining = cdromReadDataNumSectors;
+    uint32_t deadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+
+    while (cdromReadDataNumSectors)
+    {
+        if (!waitingForInt5)
+            return false;
+
+        if (remaining != cdromReadDataNumSectors)
+        {
+            remaining = cdromReadDataNumSectors;
+            deadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+        }
+        else if (timer_isDeadlinePassed(deadline))
+        {
+            _getStats(CDROM_CMD_READ_N)->timeouts++;
+            return false;
+        }
+
+        task_yield();
+    }
+
+    return true;
+}
+
+/* Read tracking */
+
+// Each read started by startCDROMRead() gets a new ID. As only one read can be
+// in progress at a time, the number of sectors left in the previous read is
+// saved when a new one is started, allowing code that issued an asynchronous
+// read to find out how much of it actually completed.
+static uint32_t cdromReadId            = 0;
+static uint32_t supersededReadId       = 0;
+static size_t   supersededReadRemaining = 0;
+
+// LBA right after the last sector requested from the drive, i.e. roughly where
+// the drive's head will be once the current read is done.
+static uint32_t cdromHeadLba = 0;
+
+// Also keeps the queue going, as the read's commands may not have all been
+// sent yet.
+static bool _isReadDone(void) {
+    _pollQueue();
+    return !cdromReadDataNumSectors;
+}
+
+// Waits for any asynchronous read still in progress to finish before its state
+// is overwritten. A read that stops making progress is abandoned.
+static void _finishPendingRead(void) {
+    size_t remaining = cdromReadDataNumSectors;
+
+    while (remaining) {
+        if (!_waitUntil(_isReadDone, CDROM_SECTOR_TIMEOUT, true) && (remaining == cdromReadDataNumSectors)) {
+            DEBUG_PRINT("Abandoning stalled read\n");
+            _getStats(CDROM_CMD_READ_N)->timeouts++;
+            break;
+        }
+
+        remaining = cdromReadDataNumSectors;
+    }
+
+    supersededReadId        = cdromReadId;
+    supersededReadRemaining = cdromReadDataNumSectors;
+    cdromReadDataNumSectors = 0;
+}
+
+void cdrom_cancelRead(void) {
+    bool enable = disableInterrupts();
+
+    if (cdromReadDataNumSectors) {
+        supersededReadId        = cdromReadId++;
+        supersededReadRemaining = cdromReadDataNumSectors;
+        cdromReadDataNumSectors = 0;
+
+        _enqueueCommand(CDROM_CMD_PAUSE, NULL, 0, NULL, NULL);
+        _deferIssue();
+    }
+
+    if (enable)
+        enableInterrupts();
+
+    _pollQueue();
+}
+
+uint32_t cdrom_getReadId(void) {
+    return cdromReadId;
+}
+
+uint32_t cdrom_getHeadPosition(void) {
+    return cdromHeadLba;
+}
+
+size_t cdrom_getReadRemaining(uint32_t readId) {
+    _pollQueue();
+
+    if (readId == cdromReadId)
+        return cdromReadDataNumSectors;
+    if (readId == supersededReadId)
+        return supersededReadRemaining;
+
+    return CDROM_READ_UNKNOWN;
+}
 
 /// @brief 
 /// @param lba LBA of the sector to read
@@ -140,60 +603,184 @@ void waitForINT5(){
 /// @param sectorSize Size of sector (2048)
 /// @param doubleSpeed Read at double speed
 /// @param wait Block until read completed
+/// @param ringSectors Length of the buffer in sectors if it is to be used as a
+/// ring, 0 otherwise
 
-void startCDROMRead(uint32_t lba, void *ptr, size_t numSectors, size_t sectorSize, bool doubleSpeed, bool wait)
+static bool _startRead(uint32_t lba, void *ptr, size_t numSectors, size_t sectorSize, bool doubleSpeed, bool wait, size_t ringSectors)
 {
+    // Single-sector blocking reads are almost always filesystem metadata, so
+    // try to serve them from the sector cache. This must happen before touching
+    // any of the read state, as an asynchronous read may still be in progress.
+    bool cacheable = wait && (numSectors == 1) && (sectorSize == SECTOR_CACHE_SECTOR_SIZE);
+
+    if (cacheable && sectorCache_read(lba, ptr))
+        return true;
+
+    _finishPendingRead();
+
+    cdromReadId++;
+    cdromHeadLba = lba + numSectors;
     cdromReadDataPtr = ptr;
     cdromReadDataNumSectors = numSectors;
     cdromReadDataSectorSize = sectorSize;
+    cdromReadRingStart = ringSectors ? ptr : NULL;
+    cdromReadRingEnd = ringSectors ? ((uint8_t *) ptr + ringSectors * sectorSize) : NULL;
 
 	uint8_t mode = 0;
-    CDROMMSF     msf;
 
     if (sectorSize == 2340)
         mode |= CDROM_MODE_SIZE_2340 ;
     if (doubleSpeed)
         mode |= CDROM_MODE_SPEED_2X;
 
-    cdrom_convertLBAToMSF(&msf, lba);
-    delayMicroseconds(100);
+    // The data ready flag is cleared here as the commands may not be sent right
+    // away.
+    cdromDataReady = false;
 
-    //DEBUG_PRINT("LBA Set: %d (%02x:%02x:%02x), issue setmode\n", lba, msf.minute, msf.second, msf.frame);
-    issueCDROMCommand(CDROM_CMD_SETMODE, &mode, sizeof(mode));
-    waitForINT3();
-    //DEBUG_PRINT("Issue SETLOC\n");
-    issueCDROMCommand(CDROM_CMD_SETLOC, (const uint8_t *)&msf, sizeof(msf));
-    waitForINT3();
-    //DEBUG_PRINT("Issue CDREAD\n");
-    issueCDROMCommand(CDROM_CMD_READ_N, NULL, 0);
-    waitForINT3();
-	
-	if (!waitingForInt5)
-	{
-		return;
-	}
-	
-    if ( !waitingForInt1 ) DEBUG_PRINT(" what's going on!?\n");
+    if (!wait)
+        return _readSectors(lba, mode, false);
+
+    uint32_t backoff = CDROM_RETRY_BACKOFF;
 
-    if (wait)
+    for (int attempt = 0; ; attempt++)
     {
-        while (waitingForInt1)
+        if (_readSectors(lba + (numSectors - cdromReadDataNumSectors), mode, true))
         {
-            // busy wait
-            delayMicroseconds(100);
-            if (!waitingForInt5)
-			{
-				return;
-			}
+            if (cacheable)
+                sectorCache_insert(lba, ptr);
+
+            return true;
         }
+        if (attempt >= CDROM_READ_RETRIES)
+            break;
+
+        // Make sure the drive is no longer sending data before working out
+        // where to resume from, then give it some time to recover. Other
+        // tasks keep running meanwhile.
+        DEBUG_PRINT("Read at LBA %d failed, retrying\n", lba);
+        _getStats(CDROM_CMD_READ_N)->retries++;
+        cdrom_waitForCommand(_submitCommandBlocking(CDROM_CMD_PAUSE, NULL, 0));
+
+        uint32_t deadline = timer_getDeadline(backoff);
+
+        while (!timer_isDeadlinePassed(deadline))
+            task_yield();
+
+        backoff *= 2;
     }
-    //DEBUG_PRINT("Finish read\n");
+
+    // Stop any further sectors from being written to the caller's buffer.
+    DEBUG_PRINT("Read at LBA %d failed\n", lba);
+    cdromReadDataNumSectors = 0;
+    _submitCommandBlocking(CDROM_CMD_PAUSE, NULL, 0);
+    return false;
+}
+
+bool startCDROMRead(uint32_t lba, void *ptr, size_t numSectors, size_t sectorSize, bool doubleSpeed, bool wait)
+{
+    return _startRead(lba, ptr, numSectors, sectorSize, doubleSpeed, wait, 0);
+}
+
+void cdrom_startRingRead(uint32_t lba, void *ptr, size_t numSectors, size_t ringSectors, bool doubleSpeed)
+{
+    _startRead(lba, ptr, numSectors, 2048, doubleSpeed, false, ringSectors);
+}
+
+/* Disc readiness polling */
+
+static CDROMDiscState discState        = CDROM_DISC_READY;
+static CDROMTicket    discPollTicket   = 0;
+static uint8_t        discPollCommand  = 0;
+static uint32_t       discPollDeadline = 0;
+
+// Flags in the second byte of a GetID response.
+#define GET_ID_FLAG_MISSING_DISC (1 << 6)
+
+// Returns whether the drive's status shows a spinning disc that can be read.
+static bool _isDiscReadable(uint8_t status) {
+    return (status & CDROM_CMD_STAT_SPINDLE_ON) && !(status & (0
+        | CDROM_CMD_STAT_ERROR
+        | CDROM_CMD_STAT_LID_OPEN
+        | CDROM_CMD_STAT_SEEKING
+    ));
+}
+
+void cdrom_startDiscPoll(uint32_t timeout) {
+    discState        = CDROM_DISC_POLLING;
+    discPollTicket   = 0;
+    discPollDeadline = timer_getDeadline(timeout);
+}
+
+CDROMDiscState cdrom_pollDisc(void) {
+    if (discState != CDROM_DISC_POLLING)
+        return discState;
+
+    // Any command still in flight is left to complete in the background.
+    if (timer_isDeadlinePassed(discPollDeadline)) {
+        DEBUG_PRINT("Timed out waiting for disc\n");
+        discState = CDROM_DISC_TIMEOUT;
+        return discState;
+    }
+
+    if (discPollTicket) {
+        if (!cdrom_isCommandDone(discPollTicket))
+            return discState;
+
+        CDROMTicket ticket = discPollTicket;
+        int         result = cdrom_waitForCommand(ticket);
+        discPollTicket = 0;
+
+        if (discPollCommand == CDROM_CMD_GET_ID) {
+            // GetID only returns a second response for a licensed data disc.
+            // Audio and unlicensed discs are reported through an error
+            // response instead, which still means the TOC has been read as
+            // long as the disc is not flagged as missing.
+            const uint8_t *error = cdromQueueErrors[ticket % CDROM_QUEUE_LENGTH];
+
+            bool readable = (result == CDROM_RESULT_ERROR) &&
+                _isDiscReadable(error[0]) &&
+                !(error[1] & GET_ID_FLAG_MISSING_DISC);
+
+            if ((result >= 0) || readable) {
+                discState = CDROM_DISC_READY;
+                return discState;
+            }
+        } else if ((result >= 0) && _isDiscReadable(result)) {
+            discPollCommand = CDROM_CMD_GET_ID;
+            discPollTicket  =
+                cdrom_submitCommand(CDROM_CMD_GET_ID, NULL, 0, NULL, NULL);
+            return discState;
+        }
+    }
+
+    discPollCommand = CDROM_CMD_NOP;
+    discPollTicket  = cdrom_submitCommand(CDROM_CMD_NOP, NULL, 0, NULL, NULL);
+    return discState;
+}
+
+void cdrom_logStats(void) {
+    for (int i = 0; i < CDROM_STATS_COMMANDS; i++) {
+        const CDROMCommandStats *stats = &cdromStats[i];
+
+        if (stats->timeouts || stats->errors || stats->retries)
+            DEBUG_PRINT(
+                "Command %02x: %d timeouts, %d errors, %d retries\n", i,
+                stats->timeouts, stats->errors, stats->retries
+            );
+    }
+
+    DEBUG_PRINT(
+        "Sector cache: %d hits, %d misses\n", sectorCacheStats.hits,
+        sectorCacheStats.misses
+    );
 }
 
 void updateCDROM_TOC(void) {
 	
 	uint8_t session = 1;
 	
+	// Reloading the TOC usually means a different disc image is now mounted.
+	sectorCache_invalidate();
 	issueCDROMCommand(CDROM_CMD_SETSESSION, &session, sizeof(session));
 	
 	waitForINT3();
@@ -202,7 +789,10 @@ void updateCDROM_TOC(void) {
 
 int is_playstation_cd(void) {
 	uint8_t tmpbuf[2048];
-	startCDROMRead(16, tmpbuf, 1, 2048, 1, 1);
+	if (!startCDROMRead(16, tmpbuf, 1, 2048, 1, 1))
+	{
+		return 0;
+	}
 	
 	if (!memcmp(&tmpbuf[8], "PLAYSTATION", 11))
 	{
@@ -241,6 +831,14 @@ int is_playstation_cd(void) {
 
 #include <stdio.h>
 void cdromINT1(void){
+    // Ignore any sector that arrives after the drive was asked to pause.
+    if (!cdromReadDataNumSectors)
+        return;
+
+    // Unlike sending commands, the transfer cannot be deferred as the sector
+    // buffer must be drained before the next sector arrives. Starting the DMA
+    // only takes a few register writes.
+
     DMA_MADR(DMA_CDROM) = (uint32_t) cdromReadDataPtr;
     DMA_BCR(DMA_CDROM)  = cdromReadDataSectorSize / 4;
     DMA_CHCR(DMA_CDROM) = DMA_CHCR_ENABLE | DMA_CHCR_TRIGGER;
@@ -249,8 +847,11 @@ void cdromINT1(void){
     cdromReadDataPtr = (void *) (
         (uintptr_t) cdromReadDataPtr + cdromReadDataSectorSize
     );
+    if (cdromReadDataPtr == cdromReadRingEnd)
+        cdromReadDataPtr = cdromReadRingStart;
     if ((--cdromReadDataNumSectors) <= 0){
-        issueCDROMCommand(CDROM_CMD_PAUSE , NULL, 0);
+        _enqueueCommand(CDROM_CMD_PAUSE, NULL, 0, NULL, NULL);
+        _deferIssue();
     }
         
     atomic_signal_fence(memory_order_release);
@@ -262,6 +863,7 @@ void cdromINT2(void){
     // Do something to handle this interrupt.
     waitingForInt2 = false;
     cdromDataReady = true;
+    _handleCommandResponse(CDROM_IRQ_COMPLETE);
     return;
 }
 
@@ -269,7 +871,8 @@ void cdromINT2(void){
 void cdromINT3(void){
     cdromStatus = cdromResponse[0];
     waitingForInt3 = false;
-    
+    _handleCommandResponse(CDROM_IRQ_ACKNOWLEDGE);
+
     return;
 }
 
@@ -282,6 +885,8 @@ void cdromINT4(void){
 // This is the "Error" interrupt.
 void cdromINT5(void){
     waitingForInt5 = false;
+    _getStats(cdromLastCommand)->errors++;
+    _handleCommandResponse(CDROM_IRQ_ERROR);
     return;
 }
 
@@ -300,7 +905,10 @@ size_t file_load(const char *name, void *sectorBuffer){
 		DEBUG_PRINT("LBA: %d\n", modelLba);
 	}
 
-	startCDROMRead( modelLba, sectorBuffer, 1, 2048, true, true );
+	if (!startCDROMRead( modelLba, sectorBuffer, 1, 2048, true, true ))
+	{
+		return 1;
+	}
 
 	return 0;
 }
@@ -27,15 +27,207 @@ extern uint8_t cdromLastReadPurpose;
 
 #define CDROM_BUSY (CDROM_HSTS & CDROM_HSTS_BUSYSTS)
 
+#define CDROM_QUEUE_LENGTH 16
+#define CDROM_MAX_ARGS     16
+
+// Timeouts in microseconds. Acknowledges normally arrive within a millisecond,
+// but second responses and the first sector of a read may have to wait for the
+// drive to spin up. Failed reads are retried with an exponentially increasing
+// delay between attempts.
+#define CDROM_BUSY_TIMEOUT     10000
+#define CDROM_ACK_TIMEOUT      200000
+#define CDROM_COMPLETE_TIMEOUT 5000000
+#define CDROM_SECTOR_TIMEOUT   5000000
+#define CDROM_READ_RETRIES     3
+#define CDROM_RETRY_BACKOFF    20000
+
+#define CDROM_RESULT_ERROR   -1
+#define CDROM_RESULT_TIMEOUT -2
+
+// Diagnostic counters, indexed by command. Entry 0 (which is not a valid
+// command) collects events for any command outside of this range.
+#define CDROM_STATS_COMMANDS 0x20
+
+typedef struct {
+    uint16_t timeouts, errors, retries;
+} CDROMCommandStats;
+
+extern CDROMCommandStats cdromStats[CDROM_STATS_COMMANDS];
+
+// Commands submitted to the queue are identified by a ticket, which increases
+// monotonically. A ticket of 0 is never handed out and signals that the queue
+// was full.
+typedef uint32_t CDROMTicket;
+
+// Completion callbacks are invoked in submission order outside of interrupt
+// context, from the deferred work queue (see irq_runDeferred()) or while
+// polling the queue, so the response may have been overwritten by then.
+//
+// The result is the status byte returned by the drive, CDROM_RESULT_ERROR if
+// the command failed or CDROM_RESULT_TIMEOUT if no response was received in
+// time.
+typedef void (*CDROMCallback)(int result, void *arg);
+
 void initCDROM(void);
 
+/**
+ * @brief Adds a command to the CD-ROM command queue. If the drive is idle the
+ * command is sent immediately, otherwise it will be sent as soon as all
+ * previously submitted commands have completed, by deferred work queued by the
+ * IRQ handler. Commands that return a second response (such as GetID, SeekL or
+ * Pause) are only considered complete once that response has been received.
+ * Must not be called from an IRQ handler, as it may wait for the drive to
+ * become ready.
+ *
+ * @param cmd
+ * @param arg Pointer to parameters, copied into the queue
+ * @param argLength
+ * @param callback Optional function to call once the command completes
+ * @param callbackArg Optional argument to be passed to the callback
+ * @return Ticket identifying the command, or 0 if the queue is full
+ */
+CDROMTicket cdrom_submitCommand(
+    uint8_t cmd, const uint8_t *arg, size_t argLength, CDROMCallback callback,
+    void *callbackArg
+);
+
+/**
+ * @brief Checks whether the command with the given ticket has completed. This
+ * also fails the command currently being processed if it has timed out.
+ *
+ * @param ticket
+ */
+bool cdrom_isCommandDone(CDROMTicket ticket);
+
+/**
+ * @brief Blocks until the command with the given ticket has completed. Must not
+ * be called from an IRQ handler.
+ *
+ * @param ticket
+ * @return Status byte returned by the drive, CDROM_RESULT_ERROR or
+ * CDROM_RESULT_TIMEOUT
+ */
+int cdrom_waitForCommand(CDROMTicket ticket);
+
+/**
+ * @brief Returns true if there are no pending commands in the queue.
+ */
+bool cdrom_isQueueIdle(void);
+
+/**
+ * @brief Submits a command and waits until it has been sent to the drive, but
+ * not for it to complete. This is a wrapper around cdrom_submitCommand() for
+ * code that waits for responses using the waitingForIntN flags, which are reset
+ * right before each command is sent. Must not be called from an IRQ handler.
+ *
+ * @param cmd
+ * @param arg
+ * @param argLength
+ */
 void issueCDROMCommand(uint8_t cmd, const uint8_t *arg, size_t argLength);
 
-void waitForINT1();
-void waitForINT3();
-
-
-void startCDROMRead(uint32_t lba, void *ptr, size_t numSectors, size_t sectorSize, bool doubleSpeed, bool wait);
+/**
+ * @brief Waits for the last command sent to return the given response, up to
+ * a fixed timeout. A timeout is counted in the command's diagnostic counters.
+ *
+ * @return False if an error or timeout occurred, true otherwise
+ */
+bool waitForINT1(void);
+bool waitForINT2(void);
+bool waitForINT3(void);
+
+/**
+ * @brief Reads one or more sectors into the given buffer. If wait is set, the
+ * read is retried (resuming from the first sector that was not transferred) up
+ * to CDROM_READ_RETRIES times if the drive reports an error or stops sending
+ * data. Blocking reads of a single 2048-byte sector go through the sector
+ * cache.
+ *
+ * @return False if the read failed, true otherwise (always true if wait is not
+ * set)
+ */
+bool startCDROMRead(uint32_t lba, void *ptr, size_t numSectors, size_t sectorSize, bool doubleSpeed, bool wait);
+
+/**
+ * @brief Starts reading 2048-byte sectors with a single ReadN command without
+ * waiting, writing them into a buffer used as a ring: once its end is reached,
+ * the next sector goes to the beginning again. Meant for long continuous reads
+ * whose data is consumed (or discarded) as it arrives, such as benchmarks.
+ * Progress can be tracked using cdrom_getReadRemaining().
+ *
+ * @param lba
+ * @param ptr
+ * @param numSectors Total number of sectors to read
+ * @param ringSectors Length of the buffer in sectors
+ * @param doubleSpeed
+ */
+void cdrom_startRingRead(uint32_t lba, void *ptr, size_t numSectors, size_t ringSectors, bool doubleSpeed);
+
+typedef enum {
+    CDROM_DISC_POLLING = 0,
+    CDROM_DISC_READY   = 1,
+    CDROM_DISC_TIMEOUT = 2
+} CDROMDiscState;
+
+// Maximum time to wait for a newly mounted image to become readable.
+#define CDROM_MOUNT_TIMEOUT 3000000
+
+/**
+ * @brief Starts polling the drive until a readable disc is present, e.g. after
+ * mounting a new image. Use cdrom_pollDisc() to advance the poll.
+ *
+ * @param timeout Time in microseconds after which to give up
+ */
+void cdrom_startDiscPoll(uint32_t timeout);
+
+/**
+ * @brief Advances a poll started by cdrom_startDiscPoll() without blocking,
+ * meant to be called once per frame. GetStat is issued until the drive reports
+ * a spinning disc with no errors, then GetID to make sure the disc can actually
+ * be read. Audio and unlicensed discs count as ready, even though GetID
+ * returns an error for them.
+ *
+ * @return CDROM_DISC_POLLING while the poll is in progress, CDROM_DISC_READY or
+ * CDROM_DISC_TIMEOUT once it is done
+ */
+CDROMDiscState cdrom_pollDisc(void);
+
+#define CDROM_READ_UNKNOWN ((size_t) -1)
+
+/**
+ * @brief Returns the ID of the last read started by startCDROMRead() (reads
+ * served from the sector cache do not count). startCDROMRead() always waits
+ * for the previous read to finish (or abandons it if it stalls) before
+ * starting a new one.
+ */
+uint32_t cdrom_getReadId(void);
+
+/**
+ * @brief Stops the read currently in progress, if any, and pauses the drive.
+ * No more data will be written to the read's buffer after this returns.
+ */
+void cdrom_cancelRead(void);
+
+/**
+ * @brief Returns the number of sectors of the read with the given ID that have
+ * yet to be transferred. If the read was superseded by a newer one, this is
+ * the number of sectors that were never transferred.
+ *
+ * @param readId
+ * @return Number of sectors, or CDROM_READ_UNKNOWN if the read is too old
+ */
+size_t cdrom_getReadRemaining(uint32_t readId);
+
+/**
+ * @brief Returns the LBA right after the last sector requested from the drive,
+ * which is used as an estimate of the position of the drive's head.
+ */
+uint32_t cdrom_getHeadPosition(void);
+
+/**
+ * @brief Prints all non-zero diagnostic counters if CD-ROM logging is enabled.
+ */
+void cdrom_logStats(void);
 
 bool readDiscName(char *output);
 
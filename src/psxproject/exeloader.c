@@ -0,0 +1,96 @@
+#include "exeloader.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "cdfile.h"
+#include "cdrom.h"
+#include "system.h"
+#include "../logging.h"
+
+#if DEBUG_FS
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+// Executables may be loaded anywhere in main RAM past the area reserved for
+// the kernel. Addresses are compared with the segment bits masked off.
+#define EXE_RAM_START  0x00010000
+#define EXE_RAM_END    0x00200000
+#define EXE_ADDR_MASK  0x1fffffff
+
+static bool _isValidHeader(const EXEHeader *header, uint32_t fileLength){
+    if (__builtin_memcmp(header->magic, "PS-X EXE", sizeof(header->magic)))
+        return false;
+
+    uint32_t start = header->textAddress & EXE_ADDR_MASK;
+    uint32_t entry = header->entryPoint  & EXE_ADDR_MASK;
+
+    if (!header->textLength || (header->textLength > (fileLength - EXE_HEADER_SIZE)))
+        return false;
+    if ((start < EXE_RAM_START) || (header->textLength > (EXE_RAM_END - start)))
+        return false;
+
+    return (entry >= start) && (entry < (start + header->textLength));
+}
+
+bool exe_readHeader(const char *path, EXEHeader *header){
+    CDFile file;
+
+    if (!cdfile_open(&file, path))
+        return false;
+
+    uint32_t length = cdfile_getLength(&file);
+    bool     valid  = (length > EXE_HEADER_SIZE) &&
+        (cdfile_read(&file, header, sizeof(EXEHeader)) == sizeof(EXEHeader)) &&
+        _isValidHeader(header, length);
+
+    cdfile_close(&file);
+
+    if (!valid){
+        DEBUG_PRINT("%s is not a valid executable\n", path);
+        return false;
+    }
+
+    DEBUG_PRINT(
+        "%s: text %08x-%08x, entry %08x\n", path, header->textAddress,
+        header->textAddress + header->textLength, header->entryPoint
+    );
+    return true;
+}
+
+void exe_boot(
+    const char *path, uint32_t numEvents, uint32_t numThreads,
+    uint32_t stackTop
+){
+    EXEHeader header;
+
+    if (!exe_readHeader(path, &header))
+        return;
+
+    DEBUG_PRINT(
+        "Booting %s directly (EVENT=%d, TCB=%d, STACK=%08x)\n", path, numEvents,
+        numThreads, stackTop
+    );
+
+    // Let any command still queued (such as the pause issued after the last
+    // read) complete before handing the drive over to the BIOS.
+    while (!cdrom_isQueueIdle())
+        __asm__ volatile("");
+
+    // SetConf() discards all events, including the ones _96_init() sets up
+    // for the BIOS CD-ROM driver, so the drive has to be reinitialized after
+    // it. Both rely on interrupts being handled by the kernel.
+    uninstallExceptionHandler();
+    biosSetConf(numEvents, numThreads, stackTop);
+    biosExitCriticalSection();
+    biosInitCDROM();
+
+    // LoadExec() flushes the instruction cache and enters a critical section
+    // itself before jumping to the entry point. It only returns if the file
+    // could not be opened, in which case nothing has been overwritten yet.
+    biosLoadExec(path, stackTop, 0);
+
+    biosEnterCriticalSection();
+}
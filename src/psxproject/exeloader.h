@@ -0,0 +1,50 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EXE_HEADER_SIZE 2048
+
+// Header found at the beginning of every PS-EXE file. The fields from
+// entryPoint onwards are in the layout expected by the BIOS Exec() function.
+typedef struct {
+    char     magic[8];
+    uint32_t textOffset, dataOffset;
+    uint32_t entryPoint, initialGP;
+    uint32_t textAddress, textLength;
+    uint32_t dataAddress, dataLength;
+    uint32_t bssAddress, bssLength;
+    uint32_t stackAddress, stackLength;
+    uint32_t savedRegisters[5];
+} EXEHeader;
+
+/**
+ * @brief Reads and validates the header of a PS-EXE file on the disc.
+ * initFilesystem() must have been called beforehand.
+ *
+ * @param path Path to the executable, with or without the cdrom: prefix
+ * @param header
+ * @return True if the file was found and its header is valid
+ */
+bool exe_readHeader(const char *path, EXEHeader *header);
+
+/**
+ * @brief Boots an executable on the disc directly, skipping the BIOS boot
+ * sequence. Once the header has been validated, the BIOS exception handler is
+ * restored, the kernel is reconfigured with the given settings (normally taken
+ * from SYSTEM.CNF) and the executable is loaded and started by the BIOS
+ * LoadExec() function, which runs from ROM and can thus safely overwrite the
+ * menu.
+ *
+ * This function only returns on failure, in which case the menu's exception
+ * handler may no longer be installed and the caller must reboot the console
+ * using softFastReboot() or softReset().
+ *
+ * @param path Path to the executable, as found in SYSTEM.CNF
+ * @param numEvents
+ * @param numThreads
+ * @param stackTop
+ */
+void exe_boot(
+    const char *path, uint32_t numEvents, uint32_t numThreads,
+    uint32_t stackTop
+);
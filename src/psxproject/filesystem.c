@@ -4,6 +4,7 @@
 #include "stdio.h"
 #include "../logging.h"
 #include "string.h"
+#include <stdlib.h>
 
 #if DEBUG_FS
 #define DEBUG_PRINT(...) printf(__VA_ARGS__)
@@ -14,9 +15,48 @@
 // Internal global variable for this lib. Hides away the rootDirData for internal use.
 uint8_t rootDirData[2048];
 
+// Volume information taken from the PVD by getRootDirData().
+static uint32_t rootDirLba       = 0;
+static uint32_t rootDirLength    = 0;
+static uint32_t pathTableLba     = 0;
+static uint32_t pathTableLength  = 0;
+
+// The path table is loaded the first time a path with subdirectories is
+// resolved and kept around until the filesystem is reinitialized.
+static uint8_t *pathTable        = NULL;
+static bool     pathTableLoaded  = false;
+
+// Resolved paths are cached, so that looking up the same file again does not
+// require any reads at all.
+typedef struct{
+    char     path[FS_CACHE_PATH_LENGTH];
+    uint32_t lba, length;
+    uint8_t  flags;
+} ResolvedPath;
+
+static ResolvedPath resolvedPaths[FS_CACHE_ENTRIES];
+static int          nextResolvedPath = 0;
+
+static uint8_t dirSector[2048];
 
 int initFilesystem(void){
-	return getRootDirData(&rootDirData);
+    // Drop everything derived from the previous disc. The volume information
+    // is cleared as well, so that a failure below leaves the filesystem
+    // uninitialized (and resolvePath() retries) rather than pointing at the
+    // previous disc's directories.
+    rootDirLba      = 0;
+    rootDirLength   = 0;
+    pathTableLba    = 0;
+    pathTableLength = 0;
+
+    free(pathTable);
+    pathTable       = NULL;
+    pathTableLoaded = false;
+
+    for(int i = 0; i < FS_CACHE_ENTRIES; i++)
+        resolvedPaths[i].path[0] = '\0';
+
+    return getRootDirData(&rootDirData);
 }
 
 // Reads specifically the LBA that points to the root directory.
@@ -34,6 +74,7 @@ int parseDirRecord(uint8_t *dataSector, uint8_t *recordLength, DirectoryEntry *d
     *recordLength = dataSector[0];
     directoryEntry->lba = int32_LM(dataSector, 2);
     directoryEntry->length = int32_LM(dataSector, 10);
+    directoryEntry->flags = dataSector[25];
     if(*recordLength < 1){
         return 1; // End of list
     }
@@ -60,80 +101,281 @@ int getRootDirData(void *rootDirData){
    uint32_t rootDirLBA;
 
    // Read the PVD sector into ram
-   startCDROMRead(
+   if(!startCDROMRead(
       16,
       buffer,
       sizeof(buffer) / 2048,
       2048,
       true,
       true
-   );
+   )){
+      return -1;
+   }
 
 	if (strncmp((char *) &buffer[8], "PLAYSTATION", 11))
 	{
 		return -1;
 	}
    // Get the LBA for the root directory.
-   getRootDirLba(buffer, &rootDirLBA);
+   rootDirLength   = getRootDirLba(buffer, &rootDirLBA);
+   rootDirLba      = rootDirLBA;
+   pathTableLength = int32_LM(buffer, 132);
+   pathTableLba    = int32_LM(buffer, 140); // Little endian (type L) table
 
    // Read the contents of the root directory.
-   startCDROMRead(
+   if(!startCDROMRead(
       rootDirLBA,
       rootDirData,
       1,
       2048,
       true,
       true
-   );
+   )){
+      rootDirLba = 0;
+      return -1;
+   }
    
 	return 0;
 }
 
-#include <stdio.h>
+/* Path resolution */
 
-/// @brief Get the LBA to the file with a given filename, assuming it is stored in the root directory.
-/// @param rootDirData Pointer to the root directory data.
-/// @param filename String containing the filename of the requested file.
-/// @return LBA to file or 0 if not found.
-uint32_t getLbaToFile(const char *filename){
-    DirectoryEntry directoryEntry;
-    uint8_t  recLen;
-    int offset = 0;
-    while(offset < 2048){
-        if(parseDirRecord(
-            &rootDirData[offset],
-            &recLen,
-            &directoryEntry
-        )){
-           break;
+static char _toUpper(char ch){
+    return ((ch >= 'a') && (ch <= 'z')) ? (ch - 'a' + 'A') : ch;
+}
+
+// Compares a path component against an ISO9660 identifier, ignoring case. If
+// the component does not include a version number (";1"), any version will
+// match.
+static bool _matchName(const char *name, size_t nameLength, const char *id, size_t idLength){
+    size_t i = 0;
+
+    for(; (i < nameLength) && (i < idLength); i++){
+        if(_toUpper(name[i]) != _toUpper(id[i]))
+            return false;
+    }
+
+    if(i == nameLength)
+        return (i == idLength) || (id[i] == ';');
+
+    return false;
+}
+
+// Looks for an entry with the given name in a directory, walking all sectors
+// of its extent. If the directory's length is not known it is taken from its
+// "." entry.
+static bool _findInDirectory(uint32_t lba, uint32_t length, const char *name, size_t nameLength, DirectoryEntry *output){
+    for(uint32_t sector = 0; !sector || (sector < ((length + 2047) / 2048)); sector++){
+        if(!startCDROMRead(lba + sector, dirSector, 1, 2048, true, true))
+            return false;
+
+        uint32_t offset = 0;
+        uint8_t  recLen;
+
+        while(offset < 2048){
+            if(parseDirRecord(&dirSector[offset], &recLen, output))
+                break; // Records never cross sectors, move on to the next one
+
+            offset += recLen;
+
+            if(!sector && !length && !__builtin_strcmp(output->name, "."))
+                length = output->length;
+
+            DEBUG_PRINT(" Read file name: %s\n", output->name);
+
+            if(_matchName(name, nameLength, output->name, __builtin_strlen(output->name)))
+                return true;
+        }
+
+        if(!length)
+            break;
+    }
+
+    return false;
+}
+
+static bool _loadPathTable(void){
+    if(pathTableLoaded)
+        return pathTable != NULL;
+
+    pathTableLoaded = true;
+
+    if(!pathTableLength || (pathTableLength > FS_MAX_PATH_TABLE_LENGTH))
+        return false;
+
+    size_t numSectors = (pathTableLength + 2047) / 2048;
+
+    pathTable = malloc(numSectors * 2048);
+
+    if(!pathTable)
+        return false;
+
+    if(!startCDROMRead(pathTableLba, pathTable, numSectors, 2048, true, true)){
+        free(pathTable);
+        pathTable = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+// Finds the extent of the directory at the given path (made up of the first
+// length characters of a normalized path) using the path table, which lists
+// all directories on the disc along with the index of their parent. Entries
+// are sorted by depth, so a parent always comes before its children.
+static bool _findDirectoryInPathTable(const char *path, size_t length, uint32_t *lba){
+    if(!_loadPathTable())
+        return false;
+
+    uint16_t parent    = 1; // The root directory is always the first entry
+    uint32_t parentLba = rootDirLba;
+
+    while(length){
+        const char *end       = __builtin_memchr(path, '\\', length);
+        size_t     nameLength = end ? (size_t) (end - path) : length;
+
+        uint32_t offset = 0;
+        uint16_t index  = 1;
+        bool     found  = false;
+
+        while((offset + 8) <= pathTableLength){
+            const uint8_t *record = &pathTable[offset];
+            uint8_t       idLength = record[0];
+
+            if(!idLength)
+                break;
+
+            if(
+                (index > 1) &&
+                ((record[6] | (record[7] << 8)) == parent) &&
+                _matchName(path, nameLength, (const char *) &record[8], idLength)
+            ){
+                parent    = index;
+                parentLba = int32_LM(record, 2);
+                found     = true;
+                break;
+            }
+
+            offset += 8 + idLength + (idLength & 1);
+            index++;
         }
-        offset += recLen;
-        DEBUG_PRINT(" Read file name: %s\t| %s\n", directoryEntry.name, __builtin_strcmp(directoryEntry.name, filename) ? "False" : "True");
 
-        if(!__builtin_strcmp(directoryEntry.name, filename)){
-            return directoryEntry.lba;
+        if(!found)
+            return false;
+
+        path   += nameLength;
+        length -= nameLength;
+
+        if(length){
+            path++;
+            length--;
         }
     }
-    return 0;
+
+    *lba = parentLba;
+    return true;
 }
 
-bool getFileInfo(const char *filename, DirectoryEntry *output){
-    uint8_t  recLen;
-    int offset = 0;
-    initFilesystem();
-    while(offset < 2048){
-        if(parseDirRecord(
-            &rootDirData[offset],
-            &recLen,
-            output
-        ))
-           break;
-
-        offset += recLen;
-        DEBUG_PRINT(" Read file name: %s\t| %s\n", output->name, __builtin_strcmp(output->name, filename) ? "False" : "True");
-
-        if(!__builtin_strcmp(output->name, filename))
+// Strips the device prefix and any leading separators, converts forward
+// slashes to backslashes and uppercases the path.
+static void _normalizePath(char *output, const char *path, size_t outputLength){
+    if(!strncmp(path, "cdrom:", 6) || !strncmp(path, "CDROM:", 6))
+        path += 6;
+
+    while((*path == '\\') || (*path == '/'))
+        path++;
+
+    size_t i = 0;
+
+    for(; *path && (i < (outputLength - 1)); path++, i++)
+        output[i] = (*path == '/') ? '\\' : _toUpper(*path);
+
+    output[i] = '\0';
+}
+
+bool resolvePath(const char *path, DirectoryEntry *output){
+    char normalized[256];
+
+    _normalizePath(normalized, path, sizeof(normalized));
+
+    if(!rootDirLba && initFilesystem())
+        return false;
+
+    const char *name = __builtin_strrchr(normalized, '\\');
+    name = name ? (name + 1) : normalized;
+
+    for(int i = 0; i < FS_CACHE_ENTRIES; i++){
+        const ResolvedPath *cached = &resolvedPaths[i];
+
+        if(cached->path[0] && !__builtin_strcmp(cached->path, normalized)){
+            output->lba    = cached->lba;
+            output->length = cached->length;
+            output->flags  = cached->flags;
+            __builtin_strcpy(output->name, name);
             return true;
+        }
+    }
+
+    // Locate the parent directory, then search it for the file itself.
+    size_t   dirLength = name - normalized;
+    uint32_t dirLba    = rootDirLba;
+    uint32_t dirSize   = rootDirLength;
+
+    if(dirLength){
+        dirSize = 0;
+
+        if(!_findDirectoryInPathTable(normalized, dirLength - 1, &dirLba)){
+            // Fall back to walking the directory tree if the path table could
+            // not be used.
+            const char *component = normalized;
+
+            dirLba  = rootDirLba;
+            dirSize = rootDirLength;
+
+            while(component < (name - 1)){
+                const char *end = __builtin_strchr(component, '\\');
+
+                if(
+                    !_findInDirectory(dirLba, dirSize, component, end - component, output) ||
+                    !(output->flags & ISO_FLAG_DIRECTORY)
+                )
+                    return false;
+
+                dirLba    = output->lba;
+                dirSize   = output->length;
+                component = end + 1;
+            }
+        }
+    }
+
+    if(!_findInDirectory(dirLba, dirSize, name, __builtin_strlen(name), output))
+        return false;
+
+    if(__builtin_strlen(normalized) < FS_CACHE_PATH_LENGTH){
+        ResolvedPath *cached = &resolvedPaths[nextResolvedPath];
+        nextResolvedPath     = (nextResolvedPath + 1) % FS_CACHE_ENTRIES;
+
+        __builtin_strcpy(cached->path, normalized);
+        cached->lba    = output->lba;
+        cached->length = output->length;
+        cached->flags  = output->flags;
     }
-    return false; // file not found
+
+    return true;
+}
+
+/// @brief Get the LBA to the file with a given filename or path.
+/// @param filename String containing the filename (relative to the root directory) or full path of the requested file.
+/// @return LBA to file or 0 if not found.
+uint32_t getLbaToFile(const char *filename){
+    DirectoryEntry directoryEntry;
+
+    if(!resolvePath(filename, &directoryEntry))
+        return 0;
+
+    return directoryEntry.lba;
+}
+
+bool getFileInfo(const char *filename, DirectoryEntry *output){
+    return resolvePath(filename, output);
 }
@@ -9,6 +9,16 @@
 // Returns the uint32_t that is parsed.
 #define int32_LM(array, startIndex) (((uint32_t)array[startIndex]) | ((uint32_t)array[startIndex+1] << 8) | ((uint32_t)array[startIndex+2] << 16) | ((uint32_t)array[startIndex+3] << 24))
 
+#define ISO_FLAG_DIRECTORY (1 << 1)
+
+// Number of resolved paths to cache and maximum length of a cached path.
+#define FS_CACHE_ENTRIES     8
+#define FS_CACHE_PATH_LENGTH 64
+
+// Larger path tables are not loaded; paths are resolved by walking the
+// directory tree instead.
+#define FS_MAX_PATH_TABLE_LENGTH 0x4000
+
 // Global variables
 extern uint8_t gRootDirData[2048];
 
@@ -17,6 +27,7 @@ extern uint8_t gRootDirData[2048];
 typedef struct{
    uint32_t lba;
    uint32_t length;
+   uint8_t flags;
    char name[255];
 } DirectoryEntry;
 
@@ -26,5 +37,14 @@ int initFilesystem(void);
 uint32_t getRootDirLba(uint8_t *pvdSector, uint32_t *LBA);
 int parseDirRecord(uint8_t *dataSector, uint8_t *recordLength, DirectoryEntry *directoryEntry);
 int getRootDirData(void *rootDirData);
+/// @brief Resolves a path such as "cdrom:\\DIR\\FILE.EXE;1" or "DIR/FILE.EXE" (the
+/// device prefix and version number are optional and case is ignored). Parent
+/// directories are located through the path table and the last directory is
+/// searched across all of its sectors. Results are cached until the next call
+/// to initFilesystem().
+/// @param path
+/// @param output Entry to fill in with the file's LBA, length and name.
+/// @return True if the file was found, false otherwise.
+bool resolvePath(const char *path, DirectoryEntry *output);
 uint32_t getLbaToFile(const char *filename);
 bool getFileInfo(const char *filename, DirectoryEntry *output);
@@ -4,21 +4,40 @@
 
 #include "ps1/cdrom.h"
 #include "cdrom.h"
-//#include "spu.h"
+#include "spu.h"
 #include "stream.h"
+#include "task.h"
+#include "../controller.h"
 
 #include "ps1/registers.h"
-#include "delay.h"
 #include "system.h"
+#include "timer.h"
+
+typedef struct {
+    ArgFunction func;
+    void        *arg;
+} DeferredWork;
 
 volatile bool vblank = false;
+static volatile uint32_t frameCount = 0;
 extern uint8_t cdromRespLength;
 
-// Sets the global vblank variable to true.
+static DeferredWork      deferredQueue[IRQ_DEFERRED_QUEUE_LENGTH];
+static volatile uint32_t deferredHead    = 0;
+static volatile uint32_t deferredTail    = 0;
+static bool              deferredRunning = false;
+
+static volatile uint32_t maxHandlerTicks = 0;
+
+// Sets the global vblank variable to true and counts the frame, so that tasks
+// sleeping until the next vblank can tell whether one has occurred.
 void handleVSyncIRQ(void){
     vblank = true;
+    frameCount++;
 }
 
+// Only captures the response and acknowledges the IRQ; the handlers called
+// below defer anything that would require waiting on the drive.
 void handleCDROMIRQ(void) {
     CDROM_ADDRESS = 1;
 
@@ -27,6 +46,17 @@ void handleCDROMIRQ(void) {
         | CDROM_HINT_INT1
         | CDROM_HINT_INT2);
 
+    // The response is read before acknowledging the IRQ, so there is no need
+    // to wait for the acknowledgement to go through. The parameter buffer is
+    // cleared right before sending each command instead.
+    cdromRespLength = 0;
+
+    while (
+        (CDROM_HSTS & CDROM_HSTS_RSLRRDY) &&
+        (cdromRespLength < sizeof(cdromResponse))
+    )
+        cdromResponse[cdromRespLength++] = CDROM_RESULT;
+
     // If a new sector is available, request a sector buffer read.
     if (irqType == CDROM_IRQ_DATA_READY) {
         CDROM_ADDRESS = 0;
@@ -39,13 +69,6 @@ void handleCDROMIRQ(void) {
         | CDROM_HCLRCTL_CLRINT0
         | CDROM_HCLRCTL_CLRINT1
         | CDROM_HCLRCTL_CLRINT2;
-    CDROM_HCLRCTL = CDROM_HCLRCTL_CLRPRM; // Clear parameter buffer
-    delayMicroseconds(3);
-
-    cdromRespLength = 0;
-
-    while (CDROM_HSTS & CDROM_HSTS_RSLRRDY)
-        cdromResponse[cdromRespLength++] = CDROM_RESULT;
 
     switch (irqType) {
         case CDROM_IRQ_DATA_READY:
@@ -70,15 +93,39 @@ void handleCDROMIRQ(void) {
 // This is the first step to handling the IRQ.
 // It will acknowledge the interrupt on the COP0 side, and call the relevant handler for the device.
 void interruptHandlerFunction(void *arg){
+    uint32_t start = timer_getTicks();
+
     if(acknowledgeInterrupt(IRQ_VSYNC)){
         handleVSyncIRQ();
     }
     if(acknowledgeInterrupt(IRQ_CDROM)){
         handleCDROMIRQ();
     }
+    if(acknowledgeInterrupt(IRQ_DMA)){
+        spuHandleDMAInterrupt();
+    }
     if(acknowledgeInterrupt(IRQ_SPU)){
         stream_handleInterrupt(&stream);
     }
+    // The acknowledge IRQ must be handled first, as it rearms Timer 0 and
+    // discards its IRQ if it fired in the meantime.
+    if(acknowledgeInterrupt(IRQ_SIO0)){
+        controller_handleAckInterrupt();
+    }
+    if(acknowledgeInterrupt(IRQ_TIMER0)){
+        controller_handleTimerInterrupt();
+    }
+    if(acknowledgeInterrupt(IRQ_TIMER1)){
+        controller_startPoll();
+    }
+    if(acknowledgeInterrupt(IRQ_TIMER2)){
+        timer_handleInterrupt();
+    }
+
+    uint32_t time = timer_getTicks() - start;
+
+    if (time > maxHandlerTicks)
+        maxHandlerTicks = time;
 }
 
 void initIRQ(void){
@@ -87,13 +134,68 @@ void initIRQ(void){
     // You can also pass an argument to this handler.
     setInterruptHandler(interruptHandlerFunction, NULL);
     // The IRQ mask specifies which interrupt sources are actually allowed to raise an interrupt.
-    IRQ_MASK = (1 << IRQ_VSYNC) | (1 << IRQ_CDROM) | (1 << IRQ_SPU);
+    // SIO0 is unmasked by initControllerBus().
+    IRQ_MASK = (1 << IRQ_VSYNC) | (1 << IRQ_DMA) | (1 << IRQ_CDROM) | (1 << IRQ_SPU) | (1 << IRQ_TIMER0) | (1 << IRQ_TIMER1) | (1 << IRQ_TIMER2);
     enableInterrupts();
 }
 
+// Other tasks are run while waiting. The scheduler also runs deferred work
+// whenever no task is ready.
 void waitForVblank(void){
-    while(!vblank){
-        // Do nothing
-    }
+    task_sleepUntilVblank();
     vblank = false;
+    irq_runDeferred();
+}
+
+uint32_t irq_getFrameCount(void){
+    return frameCount;
+}
+
+/* Deferred work */
+
+bool irq_defer(ArgFunction func, void *arg){
+    bool enable = disableInterrupts();
+    bool queued = (deferredHead - deferredTail) < IRQ_DEFERRED_QUEUE_LENGTH;
+
+    if (queued){
+        DeferredWork *work = &deferredQueue[deferredHead % IRQ_DEFERRED_QUEUE_LENGTH];
+
+        work->func = func;
+        work->arg  = arg;
+        deferredHead++;
+    }
+
+    if (enable)
+        enableInterrupts();
+
+    return queued;
+}
+
+void irq_runDeferred(void){
+    if (deferredRunning)
+        return;
+
+    deferredRunning = true;
+
+    while (deferredTail != deferredHead){
+        bool enable = disableInterrupts();
+
+        DeferredWork work = deferredQueue[deferredTail % IRQ_DEFERRED_QUEUE_LENGTH];
+        deferredTail++;
+
+        if (enable)
+            enableInterrupts();
+
+        work.func(work.arg);
+    }
+
+    deferredRunning = false;
+}
+
+uint32_t irq_getMaxHandlerTime(void){
+    return timer_ticksToMicroseconds(maxHandlerTicks);
+}
+
+void irq_resetStats(void){
+    maxHandlerTicks = 0;
 }
\ No newline at end of file
@@ -1,5 +1,12 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
+#include "system.h"
+
+// Work that cannot be done quickly (such as sending a command to the CD-ROM
+// drive, which involves waiting for it to become ready) is not done by IRQ
+// handlers directly, but queued and run later from outside interrupt context.
+#define IRQ_DEFERRED_QUEUE_LENGTH 16
 
 extern volatile bool vblank;
 
@@ -7,3 +14,37 @@ void initIRQ(void);
 void interruptHandlerFunction(void *arg);
 void handleCDROMIRQ(void);
 void waitForVblank(void);
+
+/**
+ * @brief Returns the number of vblanks since initIRQ() was called.
+ */
+uint32_t irq_getFrameCount(void);
+
+/**
+ * @brief Queues a function to be called by the next call to irq_runDeferred().
+ * May be called both from IRQ handlers and from regular code.
+ *
+ * @param func
+ * @param arg Optional argument to be passed to the function
+ * @return False if the queue is full, true otherwise
+ */
+bool irq_defer(ArgFunction func, void *arg);
+
+/**
+ * @brief Runs all queued deferred work, including any queued while running it.
+ * Called once per frame by waitForVblank() as well as by any code that waits
+ * on a device whose IRQ handler defers work. Must not be called from an IRQ
+ * handler; nested calls (from deferred work itself) return immediately.
+ */
+void irq_runDeferred(void);
+
+/**
+ * @brief Returns the longest time spent in the interrupt handler, in
+ * microseconds, since initIRQ() or the last call to irq_resetStats().
+ */
+uint32_t irq_getMaxHandlerTime(void);
+
+/**
+ * @brief Resets the statistics returned by irq_getMaxHandlerTime().
+ */
+void irq_resetStats(void);
@@ -0,0 +1,327 @@
+#include "readbatch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cdrom.h"
+#include "sectorcache.h"
+#include "task.h"
+#include "timer.h"
+#include "../logging.h"
+
+#if DEBUG_CDROM
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+static uint32_t _getEnd(const ReadRequest *request){
+    return request->lba + request->numSectors;
+}
+
+#if DEBUG_CDROM
+// Counts the seeks needed to perform the requests in their current order,
+// starting from the given head position.
+static int _countSeeks(const ReadBatch *batch, uint32_t head){
+    int seeks = 0;
+
+    for (int i = 0; i < batch->numRequests; i++){
+        const ReadRequest *request = &batch->requests[i];
+
+        if (request->lba != head)
+            seeks++;
+
+        head = _getEnd(request);
+    }
+
+    return seeks;
+}
+#endif
+
+// Drops single-sector requests that can be served from the sector cache.
+static void _readFromCache(ReadBatch *batch){
+    int count = 0;
+
+    for (int i = 0; i < batch->numRequests; i++){
+        ReadRequest *request = &batch->requests[i];
+
+        if ((request->numSectors == 1) && sectorCache_read(request->lba, request->ptr))
+            continue;
+
+        batch->requests[count++] = *request;
+    }
+
+    batch->numRequests = count;
+}
+
+static void _sortRequests(ReadBatch *batch){
+    for (int i = 1; i < batch->numRequests; i++){
+        ReadRequest request = batch->requests[i];
+        int         j       = i;
+
+        for (; (j > 0) && (batch->requests[j - 1].lba > request.lba); j--)
+            batch->requests[j] = batch->requests[j - 1];
+
+        batch->requests[j] = request;
+    }
+}
+
+// Groups the sorted requests into runs of adjacent sectors, then orders the
+// runs so that the ones past the head are read going up and the remaining ones
+// going back down (i.e. the elevator or SCAN algorithm).
+static void _buildRuns(ReadBatch *batch, uint32_t head){
+    ReadRun runs[READ_BATCH_MAX_REQUESTS];
+    int     numRuns = 0;
+
+    for (int i = 0; i < batch->numRequests; i++){
+        const ReadRequest *request = &batch->requests[i];
+        ReadRun           *run     = &runs[numRuns - 1];
+
+        // Adjacent requests are not merged if the run's length would no
+        // longer fit in its field.
+        if (
+            numRuns && ((run->lba + run->numSectors) == request->lba) &&
+            ((run->numSectors + request->numSectors) <= UINT16_MAX)
+        ){
+            run->numSectors += request->numSectors;
+            run->count++;
+            continue;
+        }
+
+        run             = &runs[numRuns++];
+        run->lba        = request->lba;
+        run->numSectors = request->numSectors;
+        run->first      = i;
+        run->count      = 1;
+    }
+
+    int split = 0;
+
+    while ((split < numRuns) && (runs[split].lba < head))
+        split++;
+
+    batch->numRuns = 0;
+
+    for (int i = split; i < numRuns; i++)
+        batch->runs[batch->numRuns++] = runs[i];
+    for (int i = split - 1; i >= 0; i--)
+        batch->runs[batch->numRuns++] = runs[i];
+}
+
+// Returns true if the buffers of all requests in the run follow each other in
+// memory, in which case the run can be read into them directly.
+static bool _isContiguous(const ReadBatch *batch, const ReadRun *run){
+    const ReadRequest *request = &batch->requests[run->first];
+    uint8_t           *next    = request->ptr;
+
+    for (int i = run->count; i; i--, request++){
+        if (request->ptr != next)
+            return false;
+
+        next += request->numSectors * READ_BATCH_SECTOR_SIZE;
+    }
+
+    return true;
+}
+
+// Copies a run read into the temporary buffer out to each request's buffer.
+static void _scatterRun(ReadBatch *batch, const ReadRun *run){
+    const ReadRequest *request = &batch->requests[run->first];
+    const uint8_t     *ptr     = batch->runBuffer;
+
+    for (int i = run->count; i; i--, request++){
+        size_t length = request->numSectors * READ_BATCH_SECTOR_SIZE;
+
+        __builtin_memcpy(request->ptr, ptr, length);
+        ptr += length;
+    }
+
+    free(batch->runBuffer);
+    batch->runBuffer = NULL;
+}
+
+static void _complete(ReadBatch *batch, bool success){
+    if (batch->runBuffer){
+        free(batch->runBuffer);
+        batch->runBuffer = NULL;
+    }
+
+    batch->busy    = false;
+    batch->success = success;
+
+    if (batch->callback)
+        batch->callback(success, batch->callbackArg);
+}
+
+// Reads the current run using blocking reads, which are retried on errors. If
+// no temporary buffer could be allocated, each request is read on its own.
+static bool _readRunBlocking(ReadBatch *batch){
+    const ReadRun *run = &batch->runs[batch->currentRun];
+
+    if (batch->runBuffer || _isContiguous(batch, run)){
+        void *ptr = batch->runBuffer
+            ? batch->runBuffer : batch->requests[run->first].ptr;
+
+        if (!startCDROMRead(run->lba, ptr, run->numSectors, READ_BATCH_SECTOR_SIZE, true, true))
+            return false;
+        if (batch->runBuffer)
+            _scatterRun(batch, run);
+
+        return true;
+    }
+
+    const ReadRequest *request = &batch->requests[run->first];
+
+    for (int i = run->count; i; i--, request++){
+        if (!startCDROMRead(request->lba, request->ptr, request->numSectors, READ_BATCH_SECTOR_SIZE, true, true))
+            return false;
+    }
+
+    return true;
+}
+
+// Starts the next run asynchronously, or completes the batch if there are no
+// runs left.
+static void _startNextRun(ReadBatch *batch){
+    if (batch->currentRun >= batch->numRuns){
+        _complete(batch, true);
+        return;
+    }
+
+    const ReadRun *run = &batch->runs[batch->currentRun];
+    void          *ptr = batch->requests[run->first].ptr;
+
+    if (!_isContiguous(batch, run)){
+        batch->runBuffer = malloc(run->numSectors * READ_BATCH_SECTOR_SIZE);
+        ptr              = batch->runBuffer;
+
+        if (!ptr){
+            if (!_readRunBlocking(batch)){
+                _complete(batch, false);
+                return;
+            }
+
+            batch->currentRun++;
+            _startNextRun(batch);
+            return;
+        }
+    }
+
+    startCDROMRead(run->lba, ptr, run->numSectors, READ_BATCH_SECTOR_SIZE, true, false);
+
+    batch->readId    = cdrom_getReadId();
+    batch->remaining = run->numSectors;
+    batch->deadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+}
+
+void readBatch_init(ReadBatch *batch){
+    batch->numRequests = 0;
+    batch->numRuns     = 0;
+    batch->runBuffer   = NULL;
+    batch->busy        = false;
+    batch->success     = false;
+}
+
+bool readBatch_add(ReadBatch *batch, uint32_t lba, void *ptr, size_t numSectors){
+    if (batch->busy || (batch->numRequests >= READ_BATCH_MAX_REQUESTS) || !numSectors)
+        return false;
+    if (numSectors > UINT16_MAX)
+        return false;
+
+    ReadRequest *request = &batch->requests[batch->numRequests++];
+
+    request->lba        = lba;
+    request->ptr        = ptr;
+    request->numSectors = numSectors;
+    return true;
+}
+
+void readBatch_start(ReadBatch *batch, ReadBatchCallback callback, void *callbackArg){
+    uint32_t head = cdrom_getHeadPosition();
+
+    batch->callback    = callback;
+    batch->callbackArg = callbackArg;
+    batch->busy        = true;
+    batch->currentRun  = 0;
+
+    _readFromCache(batch);
+
+#if DEBUG_CDROM
+    int unorderedSeeks = _countSeeks(batch, head);
+#endif
+
+    _sortRequests(batch);
+    _buildRuns(batch, head);
+
+#if DEBUG_CDROM
+    int seeks = 0;
+
+    for (int i = 0; i < batch->numRuns; i++){
+        if (batch->runs[i].lba != head)
+            seeks++;
+
+        head = batch->runs[i].lba + batch->runs[i].numSectors;
+    }
+
+    DEBUG_PRINT(
+        "Read batch: %d requests in %d runs, %d seeks instead of %d\n",
+        batch->numRequests, batch->numRuns, seeks, unorderedSeeks
+    );
+#endif
+
+    _startNextRun(batch);
+}
+
+bool readBatch_poll(ReadBatch *batch){
+    if (!batch->busy)
+        return true;
+
+    size_t remaining = cdrom_getReadRemaining(batch->readId);
+
+    if (!remaining){
+        const ReadRun *run = &batch->runs[batch->currentRun];
+
+        if (batch->runBuffer)
+            _scatterRun(batch, run);
+
+        batch->currentRun++;
+        _startNextRun(batch);
+        return !batch->busy;
+    }
+
+    // Fall back to a blocking read if the read was abandoned (e.g. because
+    // another read was started in the meantime) or has stopped making
+    // progress.
+    bool abandoned = (remaining == CDROM_READ_UNKNOWN) ||
+        (batch->readId != cdrom_getReadId());
+
+    if (remaining != batch->remaining){
+        batch->remaining = remaining;
+        batch->deadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+    }
+
+    if (!abandoned && !timer_isDeadlinePassed(batch->deadline))
+        return false;
+
+    DEBUG_PRINT("Batched read at LBA %d stalled, retrying\n", batch->runs[batch->currentRun].lba);
+
+    if (!_readRunBlocking(batch)){
+        _complete(batch, false);
+        return true;
+    }
+
+    batch->currentRun++;
+    _startNextRun(batch);
+    return !batch->busy;
+}
+
+bool readBatch_run(ReadBatch *batch){
+    readBatch_start(batch, NULL, NULL);
+
+    while (!readBatch_poll(batch))
+        task_yield();
+
+    return batch->success;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Batches of 2048-byte sector reads are reordered by position before being
+// issued, so that the drive sweeps across the disc once (in elevator order)
+// rather than seeking back and forth, and reads of adjacent sectors are merged
+// into a single ReadN command.
+#define READ_BATCH_MAX_REQUESTS 16
+#define READ_BATCH_SECTOR_SIZE  2048
+
+typedef struct {
+    uint32_t lba;
+    void     *ptr;
+    uint16_t numSectors;
+} ReadRequest;
+
+// A run is a group of requests for adjacent sectors, read with one command.
+typedef struct {
+    uint32_t lba;
+    uint16_t numSectors;
+    uint8_t  first, count;
+} ReadRun;
+
+typedef void (*ReadBatchCallback)(bool success, void *arg);
+
+typedef struct {
+    ReadRequest requests[READ_BATCH_MAX_REQUESTS];
+    ReadRun     runs[READ_BATCH_MAX_REQUESTS];
+    uint8_t     numRequests, numRuns, currentRun;
+
+    uint8_t  *runBuffer;
+    uint32_t readId, deadline;
+    size_t   remaining;
+    bool     busy, success;
+
+    ReadBatchCallback callback;
+    void              *callbackArg;
+} ReadBatch;
+
+/**
+ * @brief Initializes an empty batch.
+ *
+ * @param batch
+ */
+void readBatch_init(ReadBatch *batch);
+
+/**
+ * @brief Adds a read to a batch that has not been started yet.
+ *
+ * @param batch
+ * @param lba
+ * @param ptr Buffer to read into, must be large enough for all sectors
+ * @param numSectors Number of sectors to read, at most UINT16_MAX
+ * @return False if the batch is full or numSectors is out of range, true
+ * otherwise
+ */
+bool readBatch_add(ReadBatch *batch, uint32_t lba, void *ptr, size_t numSectors);
+
+/**
+ * @brief Orders the reads in the batch and starts the first one. Single-sector
+ * reads are served from the sector cache if possible. readBatch_poll() must
+ * then be called periodically until the batch completes.
+ *
+ * @param batch
+ * @param callback Optional function to call once all reads have completed
+ * @param callbackArg Optional argument to be passed to the callback
+ */
+void readBatch_start(ReadBatch *batch, ReadBatchCallback callback, void *callbackArg);
+
+/**
+ * @brief Checks on the read in progress and starts the next one once it is
+ * done. A read that stalls is retried as a blocking read. Invokes the batch's
+ * callback once all reads have completed or one of them has failed.
+ *
+ * @param batch
+ * @return True if the batch has completed, false otherwise
+ */
+bool readBatch_poll(ReadBatch *batch);
+
+/**
+ * @brief Starts a batch and blocks until it has completed.
+ *
+ * @param batch
+ * @return True if all reads succeeded, false otherwise
+ */
+bool readBatch_run(ReadBatch *batch);
@@ -0,0 +1,63 @@
+#include "sectorcache.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t lba, lastUsed;
+    bool     valid;
+    uint8_t  data[SECTOR_CACHE_SECTOR_SIZE];
+} SectorCacheEntry;
+
+SectorCacheStats sectorCacheStats;
+
+static SectorCacheEntry cacheEntries[SECTOR_CACHE_ENTRIES];
+static uint32_t         useCounter = 0;
+
+bool sectorCache_read(uint32_t lba, void *output){
+    for (int i = 0; i < SECTOR_CACHE_ENTRIES; i++){
+        SectorCacheEntry *entry = &cacheEntries[i];
+
+        if (entry->valid && (entry->lba == lba)){
+            entry->lastUsed = ++useCounter;
+            __builtin_memcpy(output, entry->data, SECTOR_CACHE_SECTOR_SIZE);
+
+            sectorCacheStats.hits++;
+            return true;
+        }
+    }
+
+    sectorCacheStats.misses++;
+    return false;
+}
+
+void sectorCache_insert(uint32_t lba, const void *data){
+    SectorCacheEntry *victim = &cacheEntries[0];
+
+    // Reuse the entry if the sector is already cached, otherwise pick an empty
+    // slot or the least recently used one.
+    for (int i = 0; i < SECTOR_CACHE_ENTRIES; i++){
+        SectorCacheEntry *entry = &cacheEntries[i];
+
+        if (entry->valid && (entry->lba == lba)){
+            victim = entry;
+            break;
+        }
+        if (!entry->valid){
+            if (victim->valid)
+                victim = entry;
+        } else if (victim->valid && (entry->lastUsed < victim->lastUsed)){
+            victim = entry;
+        }
+    }
+
+    victim->lba      = lba;
+    victim->lastUsed = ++useCounter;
+    victim->valid    = true;
+    __builtin_memcpy(victim->data, data, SECTOR_CACHE_SECTOR_SIZE);
+}
+
+void sectorCache_invalidate(void){
+    for (int i = 0; i < SECTOR_CACHE_ENTRIES; i++)
+        cacheEntries[i].valid = false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Small LRU cache of 2048-byte sectors, keyed by LBA. It sits underneath
+// startCDROMRead() and is meant for metadata (volume descriptors, directories)
+// that is read over and over again; it must be invalidated whenever the disc
+// contents may have changed.
+#define SECTOR_CACHE_ENTRIES     8
+#define SECTOR_CACHE_SECTOR_SIZE 2048
+
+typedef struct {
+    uint32_t hits, misses;
+} SectorCacheStats;
+
+extern SectorCacheStats sectorCacheStats;
+
+/**
+ * @brief Copies the sector at the given LBA into the output buffer if it is
+ * cached, and marks it as most recently used.
+ *
+ * @param lba
+ * @param output
+ * @return True on a cache hit, false otherwise
+ */
+bool sectorCache_read(uint32_t lba, void *output);
+
+/**
+ * @brief Adds a sector to the cache, evicting the least recently used one if
+ * the cache is full.
+ *
+ * @param lba
+ * @param data
+ */
+void sectorCache_insert(uint32_t lba, const void *data);
+
+/**
+ * @brief Drops all cached sectors. Must be called after a new disc image is
+ * mounted or the TOC is reloaded.
+ */
+void sectorCache_invalidate(void);
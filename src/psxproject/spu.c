@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "ps1/cdrom.h"
 #include "filesystem.h"
 #include "spu.h"
@@ -7,6 +8,9 @@
 #include "system.h"
 #include "cdrom.h"
 #include "delay.h"
+#include "irq.h"
+#include "task.h"
+#include "timer.h"
 #include "../logging.h"
 
 #if DEBUG_SPU
@@ -21,8 +25,6 @@ static const int _DMA_CHUNK_SIZE = 4;
 static const int _DMA_TIMEOUT    = 100000;
 static const int _STATUS_TIMEOUT = 10000;
 
-uint32_t spuAllocPtr = 0x1010; // Pointer to the next free space in SPU ram
-
 static bool _waitForStatus(uint16_t mask, uint16_t value){
     for(int timeout = _STATUS_TIMEOUT; timeout > 0; timeout -= 10) {
         if((SPU_STAT & mask) == value){
@@ -35,6 +37,279 @@ static bool _waitForStatus(uint16_t mask, uint16_t value){
     return false;
 }
 
+/* SPU RAM allocation */
+
+// The heap is described by a table of blocks sorted by offset, covering the
+// entire heap with no gaps. Adjacent free blocks are always merged.
+typedef struct {
+    uint32_t offset, length;
+    bool     used;
+} SPUBlock;
+
+static SPUBlock _heapBlocks[SPU_HEAP_MAX_BLOCKS];
+static int      _numHeapBlocks = 0;
+
+static void _resetHeap(void){
+    _heapBlocks[0].offset = DUMMY_BLOCK_END;
+    _heapBlocks[0].length = SPU_RAM_END - DUMMY_BLOCK_END;
+    _heapBlocks[0].used   = false;
+    _numHeapBlocks        = 1;
+}
+
+static void _removeHeapBlock(int index){
+    _numHeapBlocks--;
+
+    for(int i = index; i < _numHeapBlocks; i++){
+        _heapBlocks[i] = _heapBlocks[i + 1];
+    }
+}
+
+uint32_t spuAlloc(size_t length){
+    length = roundup(length, SPU_HEAP_ALIGNMENT);
+
+    if(!length){
+        return 0;
+    }
+
+    // First fit, which keeps long-lived allocations (such as the UI sounds
+    // loaded at startup) packed at the bottom of the heap.
+    for(int i = 0; i < _numHeapBlocks; i++){
+        SPUBlock *block = &_heapBlocks[i];
+
+        if(block->used || (block->length < length)){
+            continue;
+        }
+
+        // Split the block if there is any space left over. If the block table
+        // is full, the whole block is handed out instead.
+        if((block->length > length) && (_numHeapBlocks < SPU_HEAP_MAX_BLOCKS)){
+            for(int j = _numHeapBlocks; j > (i + 1); j--){
+                _heapBlocks[j] = _heapBlocks[j - 1];
+            }
+
+            _heapBlocks[i + 1].offset = block->offset + length;
+            _heapBlocks[i + 1].length = block->length - length;
+            _heapBlocks[i + 1].used   = false;
+            block->length             = length;
+            _numHeapBlocks++;
+        }
+
+        block->used = true;
+        return block->offset;
+    }
+
+    DEBUG_PRINT("Failed to allocate %d bytes of SPU RAM\n", length);
+    return 0;
+}
+
+void spuFree(uint32_t offset){
+    if(!offset){
+        return;
+    }
+
+    for(int i = 0; i < _numHeapBlocks; i++){
+        if((_heapBlocks[i].offset != offset) || !_heapBlocks[i].used){
+            continue;
+        }
+
+        _heapBlocks[i].used = false;
+
+        if((i + 1) < _numHeapBlocks && !_heapBlocks[i + 1].used){
+            _heapBlocks[i].length += _heapBlocks[i + 1].length;
+            _removeHeapBlock(i + 1);
+        }
+        if(i && !_heapBlocks[i - 1].used){
+            _heapBlocks[i - 1].length += _heapBlocks[i].length;
+            _removeHeapBlock(i);
+        }
+        return;
+    }
+
+    DEBUG_PRINT("Attempted to free invalid SPU RAM offset %x\n", offset);
+}
+
+void spuGetHeapStats(SPUHeapStats *stats){
+    __builtin_memset(stats, 0, sizeof(SPUHeapStats));
+
+    for(int i = 0; i < _numHeapBlocks; i++){
+        const SPUBlock *block = &_heapBlocks[i];
+
+        if(block->used){
+            stats->usedBytes += block->length;
+            stats->usedBlocks++;
+        } else {
+            stats->freeBytes += block->length;
+            stats->freeBlocks++;
+
+            if(block->length > stats->largestFreeBlock){
+                stats->largestFreeBlock = block->length;
+            }
+        }
+    }
+}
+
+void spuLogHeap(void){
+#if DEBUG_SPU
+    SPUHeapStats stats;
+    spuGetHeapStats(&stats);
+
+    DEBUG_PRINT(
+        "SPU RAM: %d bytes used in %d blocks, %d free in %d blocks (largest %d)\n",
+        stats.usedBytes, stats.usedBlocks, stats.freeBytes, stats.freeBlocks,
+        stats.largestFreeBlock
+    );
+
+    for(int i = 0; i < _numHeapBlocks; i++){
+        const SPUBlock *block = &_heapBlocks[i];
+
+        DEBUG_PRINT(
+            "  %05x-%05x %s\n", block->offset, block->offset + block->length,
+            block->used ? "used" : "free"
+        );
+    }
+#endif
+}
+
+/* Channel allocation */
+
+// Allocated channels are kept in one list per priority, linked through the
+// arrays below in allocation order, so the oldest channel of each priority
+// can be found (and any channel unlinked) in constant time. NUM_CHANNELS is
+// not a constant expression in C, so it cannot be used to size the arrays.
+#define _CHANNEL_COUNT 24
+static ChannelMask _freeChannels  = 0;
+static ChannelMask _timedChannels = 0;
+
+static int8_t   _nextChannel[_CHANNEL_COUNT], _prevChannel[_CHANNEL_COUNT];
+static int8_t   _oldestChannel[NUM_PRIORITIES], _newestChannel[NUM_PRIORITIES];
+static uint8_t  _channelPriority[_CHANNEL_COUNT];
+static uint32_t _channelDeadline[_CHANNEL_COUNT];
+
+static void _resetAllocator(void){
+    _freeChannels  = ALL_CHANNELS & ~STREAM_CHANNELS;
+    _timedChannels = 0;
+
+    for(int i = 0; i < NUM_PRIORITIES; i++){
+        _oldestChannel[i] = -1;
+        _newestChannel[i] = -1;
+    }
+}
+
+static void _linkChannel(Channel ch, ChannelPriority priority){
+    _channelPriority[ch] = priority;
+    _prevChannel[ch]     = _newestChannel[priority];
+    _nextChannel[ch]     = -1;
+
+    if(_newestChannel[priority] >= 0){
+        _nextChannel[_newestChannel[priority]] = ch;
+    } else {
+        _oldestChannel[priority] = ch;
+    }
+
+    _newestChannel[priority] = ch;
+}
+
+static void _unlinkChannel(Channel ch){
+    int priority = _channelPriority[ch];
+
+    if(_prevChannel[ch] >= 0){
+        _nextChannel[_prevChannel[ch]] = _nextChannel[ch];
+    } else {
+        _oldestChannel[priority] = _nextChannel[ch];
+    }
+
+    if(_nextChannel[ch] >= 0){
+        _prevChannel[_nextChannel[ch]] = _prevChannel[ch];
+    } else {
+        _newestChannel[priority] = _prevChannel[ch];
+    }
+}
+
+// Picks an allocated channel to reuse. The oldest channel of each priority is
+// the one most likely to have finished playing, so only those are checked.
+static Channel _findChannelToSteal(ChannelPriority priority){
+    for(int i = 0; i < NUM_PRIORITIES; i++){
+        Channel ch = _oldestChannel[i];
+
+        if(
+            (ch >= 0) && (_timedChannels & (1 << ch)) &&
+            timer_isDeadlinePassed(_channelDeadline[ch])
+        ){
+            return ch;
+        }
+    }
+
+    for(int i = 0; i <= priority; i++){
+        if(_oldestChannel[i] >= 0){
+            return _oldestChannel[i];
+        }
+    }
+
+    return -1;
+}
+
+Channel allocateChannel(ChannelPriority priority, uint32_t duration){
+    bool reenableInterrupts = disableInterrupts();
+
+    Channel ch;
+
+    if(_freeChannels){
+        ch             = __builtin_ctz(_freeChannels);
+        _freeChannels &= ~(1 << ch);
+    } else {
+        ch = _findChannelToSteal(priority);
+
+        if(ch >= 0){
+            DEBUG_PRINT("Stealing channel %d\n", ch);
+            _unlinkChannel(ch);
+        }
+    }
+
+    if(ch >= 0){
+        _linkChannel(ch, priority);
+
+        if(duration){
+            _timedChannels      |= 1 << ch;
+            _channelDeadline[ch] = timer_getDeadline(duration);
+        } else {
+            _timedChannels &= ~(1 << ch);
+        }
+    }
+
+    if(reenableInterrupts){
+        enableInterrupts();
+    }
+    return ch;
+}
+
+void releaseChannels(ChannelMask mask){
+    bool reenableInterrupts = disableInterrupts();
+
+    // Skip channels that are reserved or were never allocated.
+    mask &= ALL_CHANNELS & ~(STREAM_CHANNELS | _freeChannels);
+
+    for(Channel ch = 0; mask; ch++, mask >>= 1){
+        if(!(mask & 1)){
+            continue;
+        }
+
+        _unlinkChannel(ch);
+        _freeChannels |= 1 << ch;
+    }
+
+    if(reenableInterrupts){
+        enableInterrupts();
+    }
+}
+
+ChannelMask getStreamChannels(int count){
+    if(count > STREAM_CHANNEL_COUNT){
+        return 0;
+    }
+
+    return ((1 << count) - 1) << (NUM_CHANNELS - STREAM_CHANNEL_COUNT);
+}
+
 void initSPU(void){
     BIU_DEV4_CTRL = 0
         | ( 1 <<  0) // Write delay
@@ -81,51 +356,16 @@ void initSPU(void){
     SPU_CTRL = SPU_CTRL_UNMUTE | SPU_CTRL_ENABLE;
     stopChannel(ALL_CHANNELS);
 
-    // Enable the SPU's DMA channel
+    // Enable the SPU's DMA channel and its completion IRQ, used by the
+    // transfer queue.
     DMA_DPCR |= DMA_DPCR_CH_ENABLE(DMA_SPU);
+    DMA_DICR  = (DMA_DICR & ~(DMA_DICR_CH_STAT_BITMASK | DMA_DICR_IRQ))
+        | DMA_DICR_CH_ENABLE(DMA_SPU)
+        | DMA_DICR_IRQ_ENABLE;
 
     setMasterVolume(MAX_VOLUME, 0);
-}
-
-Channel getFreeChannel(void) {
-    bool reenableInterrupts = disableInterrupts();
-
-    for(Channel ch = 0; ch < NUM_CHANNELS; ch++){
-        if(!SPU_CH_ADSR_VOL(ch)){
-            if(reenableInterrupts){
-                enableInterrupts();
-            }
-            return ch;
-        }
-    }
-    if(reenableInterrupts){
-        enableInterrupts();
-    }
-    return -1;
-}
-
-ChannelMask getFreeChannels(int count){
-    bool reenableInterrupts = disableInterrupts();
-
-    ChannelMask mask = 0;
-
-    for(Channel ch = 0; ch < NUM_CHANNELS; ch++){
-        if(SPU_CH_ADSR_VOL(ch)){
-            continue;
-        }
-
-        mask |= 1 << ch;
-        count--;
-
-        if(!count){
-            break;
-        }
-    }
-
-    if(reenableInterrupts){
-        enableInterrupts();
-    }
-    return mask;
+    _resetHeap();
+    _resetAllocator();
 }
 
 void stopChannels(ChannelMask mask){
@@ -149,74 +389,210 @@ void stopChannels(ChannelMask mask){
     SPU_FLAG_ON2 = mask >> 16;
 }
 
-size_t upload(uint32_t offset, const void *data, size_t length, bool wait){
+// Sets up the SPU and DMA channel 4 for a transfer and starts it. The channel
+// must be idle. Returns the length actually transferred, which is rounded up
+// to a multiple of the DMA chunk size.
+static size_t _startTransfer(uint32_t offset, const void *data, size_t length, bool write){
     length /= 4;
     
     // (Assert data is aligned uint32_t)
 
     length = (length + _DMA_CHUNK_SIZE - 1) / _DMA_CHUNK_SIZE;
 
-    if(!waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT)){
-        return 0;
-    }
-
     uint16_t ctrlReg = SPU_CTRL & ~SPU_CTRL_XFER_BITMASK;
+    uint16_t xferReg = write ? SPU_CTRL_XFER_DMA_WRITE : SPU_CTRL_XFER_DMA_READ;
 
     SPU_CTRL = ctrlReg;
     _waitForStatus(SPU_CTRL_XFER_BITMASK, 0);
 
     SPU_DMA_CTRL = 4;
     SPU_ADDR     = offset / 8;
-    SPU_CTRL     = ctrlReg | SPU_CTRL_XFER_DMA_WRITE;
-    _waitForStatus(SPU_CTRL_XFER_BITMASK, SPU_CTRL_XFER_DMA_WRITE);
+    SPU_CTRL     = ctrlReg | xferReg;
+    _waitForStatus(SPU_CTRL_XFER_BITMASK, xferReg);
 
     DMA_MADR(DMA_SPU) = (uint32_t)(data);
     DMA_BCR (DMA_SPU) = concat4_16(_DMA_CHUNK_SIZE, length);
     DMA_CHCR(DMA_SPU) = 0
-        | DMA_CHCR_WRITE
+        | (write ? DMA_CHCR_WRITE : DMA_CHCR_READ)
         | DMA_CHCR_MODE_SLICE
         | DMA_CHCR_ENABLE;
+
+    return length * _DMA_CHUNK_SIZE * 4;
+}
+
+size_t upload(uint32_t offset, const void *data, size_t length, bool wait){
+    if(!spuWaitForQueue() || !waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT)){
+        return 0;
+    }
+
+    length = _startTransfer(offset, data, length, true);
     
     if(wait){
         waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT);
     }
 
-    return length * _DMA_CHUNK_SIZE * 4;
+    return length;
 }
 
 size_t download(uint32_t offset, void * data, size_t length, bool wait){
-     length /= 4;
+    if(!spuWaitForQueue() || !waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT)){
+        return 0;
+    }
+
+    length = _startTransfer(offset, data, length, false);
     
-    // (Assert data is aligned uint32_t)
+    if(wait){
+        waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT);
+    }
 
-    length = (length + _DMA_CHUNK_SIZE - 1) / _DMA_CHUNK_SIZE;
+    return length;
+}
 
-    if(!waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT)){
-        return 0;
+/* Asynchronous transfers */
+
+typedef struct {
+    uint32_t    offset;
+    const void  *data;
+    size_t      length;
+    ArgFunction callback;
+    void        *arg;
+} SPUTransfer;
+
+static SPUTransfer       _transferQueue[SPU_TRANSFER_QUEUE_LENGTH];
+static volatile uint32_t _transferHead   = 0;
+static volatile uint32_t _transferTail   = 0;
+static volatile bool     _transferActive = false;
+
+// Set while a call to _deferredStart() is queued, so that it is only queued
+// once.
+static volatile bool     _transferStartDeferred = false;
+
+// Starts the oldest queued transfer, unless one is already in progress. If the
+// channel is still busy with a transfer started by upload() or download(), the
+// IRQ it raises once done will start the queued transfer instead. As setting
+// up the SPU involves waiting for it to switch transfer modes, this must not
+// be called from an IRQ handler or with interrupts disabled.
+static void _startNextTransfer(void){
+    bool reenableInterrupts = disableInterrupts();
+
+    if(
+        _transferActive || (_transferHead == _transferTail) ||
+        (DMA_CHCR(DMA_SPU) & DMA_CHCR_ENABLE)
+    ){
+        if(reenableInterrupts){
+            enableInterrupts();
+        }
+        return;
     }
 
-    uint16_t ctrlReg = SPU_CTRL & ~SPU_CTRL_XFER_BITMASK;
+    // Once the transfer is marked active nothing else starts one, so the SPU
+    // can be set up with interrupts enabled.
+    const SPUTransfer *transfer = &_transferQueue[_transferTail % SPU_TRANSFER_QUEUE_LENGTH];
+    _transferActive = true;
 
-    SPU_CTRL = ctrlReg;
-    _waitForStatus(SPU_CTRL_XFER_BITMASK, 0);
+    if(reenableInterrupts){
+        enableInterrupts();
+    }
 
-    SPU_DMA_CTRL = 4;
-    SPU_ADDR     = offset / 8;
-    SPU_CTRL     = ctrlReg | SPU_CTRL_XFER_DMA_READ;
-    _waitForStatus(SPU_CTRL_XFER_BITMASK, SPU_CTRL_XFER_DMA_READ);
+    _startTransfer(transfer->offset, transfer->data, transfer->length, true);
+}
 
-    DMA_MADR(DMA_SPU) = (uint32_t)(data);
-    DMA_BCR (DMA_SPU) = concat4_16(_DMA_CHUNK_SIZE, length);
-    DMA_CHCR(DMA_SPU) = 0
-        | DMA_CHCR_READ
-        | DMA_CHCR_MODE_SLICE
-        | DMA_CHCR_ENABLE;
-    
-    if(wait){
-        waitForDMATransfer(DMA_SPU, _DMA_TIMEOUT);
+static void _deferredStart(void *arg){
+    _transferStartDeferred = false;
+    _startNextTransfer();
+}
+
+// Queues starting the next transfer, so that it happens outside of interrupt
+// context. If the deferred work queue is full, the transfer is started by the
+// next call to spuQueueUpload() or spuWaitForQueue() instead. Must be called
+// with interrupts disabled.
+static void _deferStart(void){
+    if(!_transferStartDeferred){
+        _transferStartDeferred = irq_defer(_deferredStart, NULL);
     }
+}
 
-    return length * _DMA_CHUNK_SIZE * 4;
+bool spuQueueUpload(uint32_t offset, const void *data, size_t length, ArgFunction callback, void *arg){
+    bool reenableInterrupts = disableInterrupts();
+    bool queued             = (_transferHead - _transferTail) < SPU_TRANSFER_QUEUE_LENGTH;
+
+    if(queued){
+        SPUTransfer *transfer = &_transferQueue[_transferHead % SPU_TRANSFER_QUEUE_LENGTH];
+
+        transfer->offset   = offset;
+        transfer->data     = data;
+        transfer->length   = length;
+        transfer->callback = callback;
+        transfer->arg      = arg;
+        _transferHead++;
+    }
+
+    // The transfer can only be started right away if the caller had interrupts
+    // enabled (and thus is not an IRQ handler). This is also done if the queue
+    // is full, in case a previous attempt to defer it failed.
+    if(reenableInterrupts){
+        enableInterrupts();
+        _startNextTransfer();
+    } else {
+        _deferStart();
+    }
+
+    return queued;
+}
+
+bool spuIsQueueIdle(void){
+    __atomic_signal_fence(__ATOMIC_ACQUIRE);
+
+    return (_transferHead == _transferTail);
+}
+
+bool spuWaitForQueue(void){
+    uint32_t lastTail = _transferTail;
+    uint32_t deadline = timer_getDeadline(_DMA_TIMEOUT);
+
+    while(!spuIsQueueIdle()){
+        // The next transfer is started here if deferring it failed.
+        irq_runDeferred();
+        _startNextTransfer();
+
+        // Each transfer gets its own timeout, so that a long queue does not
+        // time out as long as it keeps moving.
+        if(_transferTail != lastTail){
+            lastTail = _transferTail;
+            deadline = timer_getDeadline(_DMA_TIMEOUT);
+        } else if(timer_isDeadlinePassed(deadline)){
+            DEBUG_PRINT("Transfer queue timed out\n");
+            return false;
+        }
+
+        task_yield();
+    }
+
+    return true;
+}
+
+void spuHandleDMAInterrupt(void){
+    if(!(DMA_DICR & DMA_DICR_CH_STAT(DMA_SPU))){
+        return;
+    }
+
+    // Acknowledge the SPU channel's flag only; writing zeroes to the other
+    // flags leaves them untouched.
+    DMA_DICR = (DMA_DICR & ~(DMA_DICR_CH_STAT_BITMASK | DMA_DICR_IRQ))
+        | DMA_DICR_CH_STAT(DMA_SPU);
+
+    if(_transferActive){
+        const SPUTransfer *transfer = &_transferQueue[_transferTail % SPU_TRANSFER_QUEUE_LENGTH];
+
+        _transferActive = false;
+        _transferTail++;
+
+        if(transfer->callback){
+            transfer->callback(transfer->arg);
+        }
+    }
+
+    _deferStart();
 }
 
 /* Sound Class */
@@ -224,6 +600,23 @@ void sound_create(Sound *sound){
     sound->offset     = 0;
     sound->sampleRate = 0;
     sound->length     = 0;
+    sound->looping    = false;
+}
+
+// Checks the flags of the ADPCM blocks in a chunk of sound data for the first
+// block that ends the sound, and sets whether the sound loops (jumps back to its
+// loop start) or stops there. Returns false if no such block is in the chunk.
+static bool _findLoopEnd(Sound *sound, const void *data, size_t length){
+    const uint8_t *block = (const uint8_t *) data;
+
+    for(; length >= 16; block += 16, length -= 16){
+        if(block[1] & LOOP_END){
+            sound->looping = (block[1] & LOOP_SUSTAIN) ? true : false;
+            return true;
+        }
+    }
+
+    return false;
 }
 bool sound_initFromVAGHeader(Sound *sound, const VAGHeader *vagHeader, uint32_t _offset){
     if(!vagHeader_validateMagic(vagHeader)){
@@ -235,8 +628,6 @@ bool sound_initFromVAGHeader(Sound *sound, const VAGHeader *vagHeader, uint32_t
     return true;
 }
 
-#include <stdio.h>
-
 /// @brief Play a sound on a given channel.
 /// @param sound Pointer to the sound to play.
 /// @param left Left channel volume.
@@ -273,6 +664,35 @@ Channel sound_playOnChannel(Sound *sound, uint16_t left, uint16_t right, Channel
     return ch;
 }
 
+uint32_t sound_getDuration(const Sound *sound){
+    if(!sound->sampleRate || sound->looping){
+        return 0;
+    }
+
+    // Each 16-byte ADPCM block holds 28 samples, and the sample rate is a 4.12
+    // fixed-point multiple of 44100 Hz.
+    uint64_t samples = (sound->length / 16) * 28;
+
+    return (samples * 1000000 * 4096) / ((uint64_t) sound->sampleRate * 44100);
+}
+
+void sound_free(Sound *sound){
+    spuFree(sound->offset);
+    sound_create(sound);
+}
+
+/// @brief Play a sound on a channel obtained from the allocator.
+/// @return Channel number playback started on, -1 if no channel could be
+/// allocated or -2 for invalid sound offset.
+Channel sound_playWithPriority(Sound *sound, uint16_t left, uint16_t right, ChannelPriority priority){
+    // Do not tie up a channel for a sound that has not been loaded.
+    if(!sound->offset){
+        return -2;
+    }
+
+    return sound_playOnChannel(sound, left, right, allocateChannel(priority, sound_getDuration(sound)));
+}
+
 int sound_loadSound(const char *name, Sound *sound){
     int remainingLength;
     int uploadedData;
@@ -299,22 +719,34 @@ int sound_loadSound(const char *name, Sound *sound){
 
     // Initialise the sound
     sound_create(sound);
-    if(!sound_initFromVAGHeader(sound, _vagHeader, spuAllocPtr)){
+    if(!sound_initFromVAGHeader(sound, _vagHeader, 0)){
         // Failed to validate magic header
         return 2;
     }
 
+    uint32_t spuOffset = spuAlloc(sound->length);
+    if(!spuOffset){
+        // Not enough SPU RAM
+        return 3;
+    }
+    sound->offset = spuOffset;
+
     remainingLength = sound->length;
 
     // Upload first sector of audio data.
     // Whether the data goes on further than this, we need to exclude the header data.
     uploadedData = upload(
-        spuAllocPtr,
+        spuOffset,
         vagHeader_getData(_vagHeader),
         min(remainingLength, (2048 - sizeof(VAGHeader))),
         true
     );
-    spuAllocPtr += uploadedData;
+    bool foundEnd = _findLoopEnd(
+        sound,
+        vagHeader_getData(_vagHeader),
+        min(remainingLength, (2048 - sizeof(VAGHeader)))
+    );
+    spuOffset += uploadedData;
     remainingLength -= uploadedData;
 
     while(remainingLength){
@@ -329,12 +761,15 @@ int sound_loadSound(const char *name, Sound *sound){
         );
 
         uploadedData = upload(
-            spuAllocPtr,
+            spuOffset,
             _sectorBuffer,
             min(remainingLength, 2048),
             true
         );
-        spuAllocPtr += uploadedData;
+        if(!foundEnd){
+            foundEnd = _findLoopEnd(sound, _sectorBuffer, min(remainingLength, 2048));
+        }
+        spuOffset += uploadedData;
         remainingLength -= uploadedData;
 
     }
@@ -346,7 +781,6 @@ int sound_loadSound(const char *name, Sound *sound){
 int sound_loadSoundFromBinary(const uint8_t *data, Sound *sound){
     
     VAGHeader *_vagHeader = (VAGHeader*) data;
-    int uploadedData;
     
     DEBUG_PRINT("%d\n",   _vagHeader->channels);
     DEBUG_PRINT("%d\n",   _vagHeader->interleave);
@@ -359,14 +793,19 @@ int sound_loadSoundFromBinary(const uint8_t *data, Sound *sound){
 
     // Initialise the sound
     sound_create(sound);
-    if(!sound_initFromVAGHeader(sound, _vagHeader, spuAllocPtr)){
+    if(!sound_initFromVAGHeader(sound, _vagHeader, 0)){
         // Failed to validate magic header
         return 2;
     }
 
-    uploadedData = upload( spuAllocPtr, vagHeader_getData(_vagHeader), sound->length, true );
-    
-    spuAllocPtr += uploadedData;
+    sound->offset = spuAlloc(sound->length);
+    if(!sound->offset){
+        // Not enough SPU RAM
+        return 3;
+    }
+
+    upload( sound->offset, vagHeader_getData(_vagHeader), sound->length, true );
+    _findLoopEnd(sound, vagHeader_getData(_vagHeader), sound->length);
     
     return 0;
 }
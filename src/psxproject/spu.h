@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "ps1/registers.h"
+#include "system.h"
 
 
 #define Channel int
@@ -28,7 +29,6 @@ static const uint16_t MAX_VOLUME   = 0x3fff;
 
 static const ChannelMask ALL_CHANNELS = (1 << NUM_CHANNELS) - 1;
 
-extern uint32_t spuAllocPtr;
 
 /* Utilities */
 
@@ -54,8 +54,6 @@ static inline size_t roundup(size_t a, size_t b) {
 /* Basic SPU API */
 
 void initSPU(void);
-Channel getFreeChannel(void);
-ChannelMask getFreeChannels(int count);
 void stopChannels(ChannelMask mask);
 
 static inline void setMasterVolume(uint16_t master, uint16_t reverb){
@@ -74,9 +72,108 @@ static inline void stopChannel(Channel ch){
     stopChannels(1 << ch);
 }
 
+// upload() and download() wait for all queued transfers to complete first.
 size_t upload(uint32_t offset, const void *data, size_t length, bool wait);
 size_t download(uint32_t offset, void *data, size_t length, bool wait);
 
+/* Asynchronous transfers */
+
+// Uploads queued using spuQueueUpload() are carried out one after another in
+// the background. Once the DMA IRQ signals that a transfer has completed, the
+// next one is started from deferred work (see irq_runDeferred()), as setting
+// up the SPU requires waiting on it.
+#define SPU_TRANSFER_QUEUE_LENGTH 16
+
+/// @brief Queue an upload to SPU RAM and return immediately. The data must
+/// remain valid until the upload has completed.
+/// @param callback Optional function to call once the upload has completed.
+/// It is called from the DMA IRQ handler, so it must be short.
+/// @param arg Optional argument to be passed to the callback.
+/// @return False if the queue is full, true otherwise.
+bool spuQueueUpload(uint32_t offset, const void *data, size_t length, ArgFunction callback, void *arg);
+
+/// @brief Return true if all queued uploads have completed.
+bool spuIsQueueIdle(void);
+
+/// @brief Wait for all queued uploads to complete, running other tasks
+/// meanwhile. Must not be called from an IRQ handler.
+/// @return False if a transfer did not complete in time, true otherwise.
+bool spuWaitForQueue(void);
+
+/// @brief Complete the current queued upload and queue starting the next one.
+/// Called by the IRQ handler on DMA IRQs.
+void spuHandleDMAInterrupt(void);
+
+/* SPU RAM allocation */
+
+// Everything between the dummy block and the reverb work area (which starts
+// at SPU_RAM_END) is managed as a heap. The heap's bookkeeping is kept in main
+// RAM, as SPU RAM cannot be accessed directly. Allocations are rounded up to
+// SPU_HEAP_ALIGNMENT bytes, the size of an ADPCM block (and of a DMA chunk).
+// The first 4 KB of SPU RAM (capture buffers) and the dummy block are never
+// handed out.
+#define SPU_HEAP_ALIGNMENT  16
+#define SPU_HEAP_MAX_BLOCKS 32
+
+typedef struct {
+    uint32_t usedBytes, freeBytes, largestFreeBlock;
+    uint16_t usedBlocks, freeBlocks;
+} SPUHeapStats;
+
+/// @brief Allocate a region of SPU RAM.
+/// @param length Length in bytes, rounded up to SPU_HEAP_ALIGNMENT.
+/// @return Offset of the region, or 0 if there is no free region large enough.
+uint32_t spuAlloc(size_t length);
+
+/// @brief Return a region obtained from spuAlloc() to the heap. Passing 0 does
+/// nothing.
+void spuFree(uint32_t offset);
+
+/// @brief Get the heap's current usage. Fragmentation can be estimated by
+/// comparing largestFreeBlock to freeBytes.
+void spuGetHeapStats(SPUHeapStats *stats);
+
+/// @brief Print the usage of the heap and a map of all blocks if SPU logging is
+/// enabled.
+void spuLogHeap(void);
+
+/* Channel allocation */
+
+// Channels are handed out by a software allocator that tracks which ones are
+// in use, rather than by looking for silent channels in hardware. The last
+// STREAM_CHANNEL_COUNT channels are reserved for music streaming and never
+// given out to sound effects. If no channel is free, a channel whose sound
+// has finished playing is reused; failing that, the oldest channel playing a
+// sound of equal or lower priority is stolen.
+#define STREAM_CHANNEL_COUNT 2
+#define NUM_PRIORITIES       3
+
+static const ChannelMask STREAM_CHANNELS =
+    ALL_CHANNELS & ~((1 << (NUM_CHANNELS - STREAM_CHANNEL_COUNT)) - 1);
+
+typedef enum {
+    PRIORITY_LOW    = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_HIGH   = 2
+} ChannelPriority;
+
+/// @brief Allocate a channel for a sound effect.
+/// @param priority Priority of the sound, used to pick a channel to steal.
+/// @param duration Time in microseconds after which the channel may be reused,
+/// or 0 to keep it until released using releaseChannels().
+/// @return Channel number, or -1 if all channels are taken by sounds of higher
+/// priority.
+Channel allocateChannel(ChannelPriority priority, uint32_t duration);
+
+/// @brief Return channels obtained from allocateChannel() to the allocator.
+/// Reserved streaming channels are ignored. The channels are not stopped.
+void releaseChannels(ChannelMask mask);
+
+/// @brief Get the reserved channels to use for a stream.
+/// @param count Number of channels required.
+/// @return Mask of channels, or 0 if not enough channels are reserved.
+ChannelMask getStreamChannels(int count);
+
 
 /* VAGHeader Class */
 
@@ -120,6 +217,7 @@ static inline const void *vagHeader_getData(const VAGHeader *vagHeader){
 typedef struct Sound {
     uint32_t offset;
     uint16_t sampleRate, length;
+    bool     looping;
 } Sound;
 
 void sound_create(Sound *sound);
@@ -127,10 +225,24 @@ void sound_create(Sound *sound);
 bool sound_initFromVAGHeader(Sound *sound, const VAGHeader *vagHeader, uint32_t _offset);
 Channel sound_playOnChannel(Sound *sound, uint16_t left, uint16_t right, Channel ch);
 
+/// @brief Get the time it takes to play a sound once, in microseconds, or 0 if
+/// the sound loops (and thus never finishes) or has not been loaded.
+uint32_t sound_getDuration(const Sound *sound);
+
+/// @brief Play a sound on a channel obtained from allocateChannel(). The
+/// channel is not released, but once the sound has finished playing it is the
+/// first one reused by later allocations. Looping sounds keep their channel
+/// until it is stopped and released using releaseChannels(), or stolen by a
+/// sound of equal or higher priority.
+Channel sound_playWithPriority(Sound *sound, uint16_t left, uint16_t right, ChannelPriority priority);
+
 static inline Channel sound_play(Sound *sound, uint16_t left, uint16_t right){
-    return sound_playOnChannel(sound, left, right, getFreeChannel());
+    return sound_playWithPriority(sound, left, right, PRIORITY_NORMAL);
 }
 
+/// @brief Free the SPU RAM used by a sound. The sound must not be playing.
+void sound_free(Sound *sound);
+
 /// @brief Load a sound from disk.
 /// @param name Filename of the VAGp file to load.
 /// @param sound Pointer to the sound struct to save the sound data in.
@@ -1,9 +1,18 @@
 #include "stream.h"
 
+#include <stdio.h>
 #include "filesystem.h"
 #include "spu.h"
 #include "system.h"
 #include "cdrom.h"
+#include "timer.h"
+#include "../logging.h"
+
+#if DEBUG_SPU
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
 
 
 // TODO:
@@ -35,10 +44,15 @@
 void stream_configureIRQ(Stream *stream){
     uint16_t ctrlReg = SPU_CTRL;
 
-    // Disable the IRQ if an underrun occurs.
+    // Disable the IRQ if an underrun occurs. The channels keep looping the
+    // last chunk until more data is fed, which re-enables it.
     // TODO: handle this in a slightly better way
     if(!stream->_bufferedChunks){
         SPU_CTRL = ctrlReg & ~SPU_CTRL_IRQ_ENABLE;
+
+        if(stream_isPlaying(stream)){
+            stream->_underruns++;
+        }
         return;
     }
 
@@ -132,7 +146,8 @@ ChannelMask stream_startWithChannelMask(uint16_t left, uint16_t right, ChannelMa
         isRightCh   ^= 1;
     }
 
-    stream._channelMask = mask;
+    stream._channelMask  = mask;
+    stream._lowWatermark = stream._bufferedChunks;
     SPU_FLAG_ON1 = mask & 0xffff;
     SPU_FLAG_ON2 = mask >> 16;
 
@@ -162,62 +177,121 @@ void stream_handleInterrupt(Stream *_stream){
 
     _stream->_head = (_stream->_head + 1) % _stream->numChunks;
     _stream->_bufferedChunks--;
+
+    if(_stream->_bufferedChunks < _stream->_lowWatermark){
+        _stream->_lowWatermark = _stream->_bufferedChunks;
+    }
     stream_configureIRQ(_stream);
 }
 
 
+// Called from the DMA IRQ handler once a chunk has been uploaded. Uploads
+// complete in the order they were queued, so the chunk is always the one
+// right after the last buffered chunk.
+static void _chunkUploaded(void *arg){
+    Stream *_stream = (Stream *)(arg);
+
+    _stream->_pendingChunks--;
+    _stream->_bufferedChunks++;
+
+    if(stream_isPlaying(_stream)){
+        stream_configureIRQ(_stream);
+    }
+}
+
 size_t stream_feed(Stream *_stream, const void *data, size_t length){
+    // Interrupts are only disabled while the chunks are queued; the uploads
+    // themselves run in the background. The data must not be overwritten until
+    // all of them have completed (i.e. _pendingChunks is zero).
     bool reenableInterrupts = disableInterrupts();
 
     uintptr_t ptr = (uintptr_t)(data);
     size_t chunkLength = stream_getChunkLength(_stream);
+    size_t fedLength   = 0;
     length = min(length, stream_getFreeChunkCount(_stream) * chunkLength);
     
     for(int i = length; i >= (int)(chunkLength); i -= chunkLength){
-        upload(
+        if(!spuQueueUpload(
             stream_getChunkOffset(_stream, _stream->_tail),
             (const void *)(ptr),
             chunkLength,
-            true
-        );
+            _chunkUploaded,
+            _stream
+        )){
+            // The rest of the data will be fed again later.
+            break;
+        }
 
-        ptr += chunkLength;
+        ptr       += chunkLength;
+        fedLength += chunkLength;
         _stream->_tail = (_stream->_tail + 1) % _stream->numChunks;
-        _stream->_bufferedChunks++;
-
-    }
-    if(stream_isPlaying(_stream)){
-        stream_configureIRQ(_stream);
+        _stream->_pendingChunks++;
     }
 
     flushWriteQueue();
     if(reenableInterrupts){
         enableInterrupts();
     }
-    return length;
+    return fedLength;
 }
 
 void stream_resetBuffer(Stream *_stream){
+    // Any uploads still in progress must complete before the buffer is reset.
+    spuWaitForQueue();
+
     _stream->_head            = 0;
     _stream->_tail            = 0;
     _stream->_bufferedChunks  = 0;
+    _stream->_pendingChunks   = 0;
+    _stream->_lowWatermark    = 0;
+    _stream->_underruns       = 0;
+}
+
+void stream_getStats(Stream *_stream, StreamStats *stats){
+    bool reenableInterrupts = disableInterrupts();
+
+    stats->bufferedChunks = _stream->_bufferedChunks;
+    stats->pendingChunks  = _stream->_pendingChunks;
+    stats->numChunks      = _stream->numChunks;
+    stats->lowWatermark   = _stream->_lowWatermark;
+    stats->underruns      = _stream->_underruns;
+
+    if(reenableInterrupts){
+        enableInterrupts();
+    }
 }
 
 /* Stream State Machine*/
 // Public Variables
 Stream stream;
 
+// Refills are read in pieces of at most this many sectors (but always at least
+// one chunk), so that other code waiting for the drive is never held up for
+// long. A refill is only started once a full piece fits in the ring buffer, to
+// avoid seeking for every chunk played.
+#define REFILL_SECTORS 8
+
+// Playback starts once this many chunks have been buffered.
+#define START_CHUNKS 8
+
 // Private Variables
-uint8_t streamBuffer[16 * 2048]; // 32 mono chunks or 16 stereo chunks
-size_t streamLength;
-size_t streamOffset;
-uint32_t songLba;
-int chunkLength;
-int streamFreeChunks;
-int feedLength;
+static uint8_t streamBuffer[16 * 2048]; // 32 mono chunks or 16 stereo chunks
+static size_t streamLength;
+static size_t streamOffset;
+static uint32_t songLba;
+static size_t chunkLength;
+static size_t refillLength;
+static size_t feedLength;
+
+static uint32_t streamReadId;
+static size_t streamReadRemaining;
+static uint32_t streamReadDeadline;
+
+static bool streamAutoPlay;
+static uint16_t streamLeftVolume, streamRightVolume;
 
 
-StreamStateMachineState streamSMState = STREAM_SM_IDLE;
+static StreamStateMachineState streamSMState = STREAM_SM_IDLE;
 
 // TODO:
 // Is this function necessary?
@@ -228,94 +302,204 @@ void stream_init(void){
 size_t stream_loadSong(const char *name){
     char _songVagHeaderSector[2048];
     VAGHeader _songVagHeader;
-    
-    songLba = getLbaToFile(name);
-    if(!songLba){
+
+    if(stream_isPlaying(&stream)){
+        // Cannot replace the song while it is playing.
+        return 2;
+    }
+
+    // Make sure no refill of the previous song is still being read or fed.
+    stream_yield();
+    streamSMState  = STREAM_SM_IDLE;
+    streamAutoPlay = false;
+    songLba        = 0;
+
+    uint32_t lba = getLbaToFile(name);
+    if(!lba){
         // File not found error.
         return 1;
     }
 
-    // Read the VAG header sector
-    startCDROMRead(
-        songLba,
+    // Read the VAG header sector. The music data is not read here, but by
+    // stream_update() in the background.
+    if(!startCDROMRead(
+        lba,
         _songVagHeaderSector,
         sizeof(_songVagHeaderSector) / 2048,
         2048,
         true,
         true
-    );
+    )){
+        // Read error
+        return 1;
+    }
 
-    
-    // The first sector of music data immediately follows the header's sector.
-    // Load it into the stream buffer
-    // TODO: Consider turning this into some kind of state machine?
-    // Maybe rewrite this entire section once coroutines are added.
-    startCDROMRead(
-        ++songLba,
-        streamBuffer,
-        sizeof(streamBuffer) / 2048,
-        2048,
-        true,
-        true
-    );
-    
     // Directly copy all the data from the VAG header sector to the VAG header struct.
     // The struct is laid out exactly how the header is stored, so this works perfectly.
     __builtin_memcpy(&_songVagHeader, _songVagHeaderSector, sizeof(VAGHeader));
 
-    // Initialise the stream and increment the spuAllocPtr.
-    stream_initFromVAGHeader(&stream, &_songVagHeader, spuAllocPtr, 32);
-    spuAllocPtr += stream_getChunkLength(&stream) * stream.numChunks;
-    chunkLength = stream_getChunkLength(&stream);
+    size_t _chunkLength = (size_t)(_songVagHeader.interleave) * vagHeader_getNumChannels(&_songVagHeader);
+
+    // Chunks are read straight from the disc, so they must be made up of whole
+    // sectors and fit in the stream buffer.
+    if(
+        !vagHeader_validateInterleavedMagic(&_songVagHeader) ||
+        !_chunkLength || (_chunkLength % 2048) ||
+        (_chunkLength > sizeof(streamBuffer)) ||
+        (vagHeader_getSPULength(&_songVagHeader) * vagHeader_getNumChannels(&_songVagHeader) < _chunkLength)
+    ){
+        // Invalid VAG header
+        return 4;
+    }
+
+    // Release the previous song's ring buffer, then allocate one for the new
+    // song and initialise the stream.
+    spuFree(stream.offset);
+    stream.offset = 0;
+
+    uint32_t ringOffset = spuAlloc(_chunkLength * 32);
+    if(!ringOffset){
+        // Not enough SPU RAM
+        return 3;
+    }
+
+    stream_initFromVAGHeader(&stream, &_songVagHeader, ringOffset, 32);
 
     // Set up these variables for the stream state machine to use when streaming more data.
+    // The first sector of music data immediately follows the header's sector.
+    songLba      = lba + 1;
+    chunkLength  = _chunkLength;
+    refillLength = (REFILL_SECTORS * 2048) / chunkLength * chunkLength;
+    if(!refillLength){
+        refillLength = chunkLength;
+    }
     streamLength = vagHeader_getSPULength(&_songVagHeader) * stream.channels;
     streamOffset = 0;
 
-    // Feed the first buffer-worth of data into the ring buffer, ready for playback.
-    streamOffset = stream_feed(&stream, streamBuffer, sizeof(streamBuffer));
+    DEBUG_PRINT(
+        "Song %s: %d bytes at LBA %d, %d byte chunks\n", name, streamLength,
+        songLba, chunkLength
+    );
 
     // Ready to play the stream!
     return 0;
 }
 
+void stream_play(uint16_t left, uint16_t right){
+    if(!songLba){
+        return;
+    }
+
+    streamLeftVolume  = left;
+    streamRightVolume = right;
+    streamAutoPlay    = true;
+}
+
+void stream_pause(void){
+    streamAutoPlay = false;
+
+    stream_stop(&stream);
+    stream_yield();
+}
+
+void stream_yield(void){
+    if(streamSMState != STREAM_SM_WAIT_FOR_DATA){
+        return;
+    }
+
+    // The refill will be read again later. Any data already fed is kept.
+    if((streamReadId == cdrom_getReadId()) && cdrom_getReadRemaining(streamReadId)){
+        cdrom_cancelRead();
+    }
+
+    streamSMState = STREAM_SM_IDLE;
+}
+
+void stream_logStats(void){
+#if DEBUG_SPU
+    StreamStats stats;
+    stream_getStats(&stream, &stats);
+
+    DEBUG_PRINT(
+        "Stream: %d/%d chunks buffered (lowest %d), %d underruns\n",
+        stats.bufferedChunks + stats.pendingChunks, stats.numChunks,
+        stats.lowWatermark, stats.underruns
+    );
+#endif
+}
 
 void stream_update(void){
-    
+    if(!songLba){
+        return;
+    }
+
     // Idle:
-    // The stream is playing audio. The CDROM isn't reading. There is no data to read.
-    // If there are enough free chunks, instruct the CDROM to read more and change
-    // state to wait for the data to be ready.
-    if(streamSMState == STREAM_SM_IDLE){
-        streamFreeChunks = stream_getFreeChunkCount(&stream);
-        if(streamFreeChunks >= 8){
-            feedLength = min(
-                (streamLength) - streamOffset,
-                min(streamFreeChunks * chunkLength, sizeof(streamBuffer))
+    // The CDROM isn't reading any music data. If there is room for a refill and
+    // the drive is not busy with anything else, start reading it in the
+    // background and change state to wait for the data to be ready. The uploads
+    // of the previous data must have completed, as they read from the same
+    // buffer.
+    if(streamSMState == STREAM_SM_IDLE && !stream._pendingChunks){
+        if(
+            (stream_getFreeChunkCount(&stream) * chunkLength >= refillLength) &&
+            !cdrom_getReadRemaining(cdrom_getReadId()) && cdrom_isQueueIdle()
+        ){
+            feedLength = min(streamLength - streamOffset, refillLength);
+
+            startCDROMRead(
+                songLba + (streamOffset / 2048),
+                streamBuffer,
+                (feedLength + 2047) / 2048,
+                2048,
+                true,
+                false
             );
-            startCDROMRead(songLba + (streamOffset / 2048), streamBuffer, feedLength / 2048, 2048, true, false);
-            streamSMState = STREAM_SM_WAIT_FOR_DATA;
+
+            streamReadId        = cdrom_getReadId();
+            streamReadRemaining = cdrom_getReadRemaining(streamReadId);
+            streamReadDeadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+            streamSMState       = STREAM_SM_WAIT_FOR_DATA;
         }
     }
 
     // Wait For Data:
-    // Check if the data is ready. If it is, change state to Data Ready
+    // Check if the data is ready. If it is, change state to Data Ready. If the
+    // read was cancelled or abandoned by other code, or has stalled, go back to
+    // Idle to read the same data again.
     if(streamSMState == STREAM_SM_WAIT_FOR_DATA){
-        if(cdromDataReady){
+        size_t remaining = cdrom_getReadRemaining(streamReadId);
+
+        if(!remaining){
             streamSMState = STREAM_SM_DATA_READY;
+        } else if((remaining == CDROM_READ_UNKNOWN) || (streamReadId != cdrom_getReadId())){
+            streamSMState = STREAM_SM_IDLE;
+        } else if(remaining != streamReadRemaining){
+            streamReadRemaining = remaining;
+            streamReadDeadline  = timer_getDeadline(CDROM_SECTOR_TIMEOUT);
+        } else if(timer_isDeadlinePassed(streamReadDeadline)){
+            DEBUG_PRINT("Stream refill stalled, retrying\n");
+            cdrom_cancelRead();
+            streamSMState = STREAM_SM_IDLE;
         }
     }
     
     // Data Ready:
-    // The CDROM has finished reading data and the Data Ready flag was raised.
-    // Feed this data into the stream ring buffer.
+    // The CDROM has finished reading data. Feed it into the stream ring buffer.
     if(streamSMState == STREAM_SM_DATA_READY){
-        // Stream length - stream offset = remaining length
         streamOffset += stream_feed(&stream, streamBuffer, feedLength);
-        // If we reached the end of the stream, loop back to the start
-        if(streamOffset >= streamLength){
-            streamOffset -= streamLength;
+
+        // If we reached the end of the stream, loop back to the start. A
+        // trailing partial chunk cannot be fed and is skipped.
+        if(streamLength - streamOffset < chunkLength){
+            streamOffset = 0;
         }
         streamSMState = STREAM_SM_IDLE;
     }
-}
\ No newline at end of file
+
+    // Start playback once enough data has been buffered. Chunks are counted
+    // once uploaded, so this never starts playing stale SPU RAM.
+    if(streamAutoPlay && (stream._bufferedChunks >= START_CHUNKS)){
+        stream_start(&stream, streamLeftVolume, streamRightVolume);
+        streamAutoPlay = false;
+    }
+}
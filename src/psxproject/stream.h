@@ -6,10 +6,19 @@
 // TODO:
 // Do most of these stream_ functions really need to be public?
 
+/* Stream Statistics */
+typedef struct StreamStats{
+    uint16_t bufferedChunks, pendingChunks, numChunks, lowWatermark;
+    uint32_t underruns;
+} StreamStats;
+
 /* Stream Class */
 typedef struct Stream{
     uint32_t _channelMask;
     uint16_t _head, _tail, _bufferedChunks;
+    uint16_t _pendingChunks; // Chunks queued for upload but not yet uploaded
+    uint16_t _lowWatermark;  // Fewest chunks buffered since playback started
+    uint32_t _underruns;     // Times the buffer ran dry while playing
 
     uint32_t offset;
     uint16_t interleave, numChunks, sampleRate, channels;
@@ -23,7 +32,7 @@ static inline size_t stream_getFreeChunkCount(Stream *stream){
 
     // The currently playing chunk cannot be overwritten.
     size_t playingChunk = stream->_channelMask ? 1 : 0;
-    return stream->numChunks - (stream->_bufferedChunks + playingChunk);
+    return stream->numChunks - (stream->_bufferedChunks + stream->_pendingChunks + playingChunk);
 
 }
 
@@ -36,7 +45,7 @@ void stream_configureIRQ(Stream *stream);
 ChannelMask stream_startWithChannelMask(uint16_t left, uint16_t right, ChannelMask mask);
 
 static inline ChannelMask stream_start(Stream *stream, uint16_t left, uint16_t right){
-    return stream_startWithChannelMask(left, right, getFreeChannels(NUM_CHANNELS));
+    return stream_startWithChannelMask(left, right, getStreamChannels(stream->channels));
 }
 static inline bool stream_isPlaying(Stream *stream){
     __atomic_signal_fence(__ATOMIC_ACQUIRE);
@@ -59,6 +68,10 @@ void stream_handleInterrupt(Stream *stream);
 size_t stream_feed(Stream *stream, const void *data, size_t length);
 void stream_resetBuffer(Stream *stream);
 
+/// @brief Take a consistent snapshot of the buffer occupancy and underrun count.
+/// The counters are reset whenever the buffer is.
+void stream_getStats(Stream *stream, StreamStats *stats);
+
 /* Stream State Machine*/
 
 // This needs to be accessible by things like IRQ for now.
@@ -76,13 +89,29 @@ typedef enum{
 // Is this function necessary?
 void stream_init(void);
 
-/// @brief Load the VAG header and prepare for song streaming
+/// @brief Load the VAG header and prepare for song streaming. Only the header
+/// is read here; the song data is buffered in the background by stream_update().
+/// Chunks (interleave times channel count) must be a multiple of 2048 bytes.
 /// @param name File path of the song.
 /// @return Zero or Error code.
 size_t stream_loadSong(const char *name);
 
-/// @brief UNUSED
-void stream_play(void);
+/// @brief Start (or resume) playing the loaded song as soon as enough of it has
+/// been buffered. Does nothing if no song is loaded.
+void stream_play(uint16_t left, uint16_t right);
+
+/// @brief Stop playback and any refill in progress. Buffered data is kept, so
+/// stream_play() resumes from the next chunk.
+void stream_pause(void);
+
+/// @brief Cancel any refill in progress without stopping playback, so that other
+/// code can use the drive right away. The data is read again later.
+void stream_yield(void);
+
+/// @brief Print the stream's statistics if SPU logging is enabled.
+void stream_logStats(void);
 
 /// @brief Update the stream state machine. Will feed more data to the ring buffer if required.
+/// Refills are read in the background and only started while the drive is idle,
+/// so this never blocks. Must be called periodically, e.g. once per frame.
 void stream_update(void);
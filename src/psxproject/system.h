@@ -143,6 +143,18 @@ void flushCache(void);
 void softReset(void);
 void softFastReboot(void);
 
+/**
+ * @brief Wrappers around the BIOS kernel's critical section syscalls and the
+ * A(51h) LoadExec(), A(71h) _96_init() and A(9Ch) SetConf() functions. These
+ * must only be called after uninstallExceptionHandler(), as they rely on the
+ * kernel's own exception handler and state.
+ */
+void biosEnterCriticalSection(void);
+void biosExitCriticalSection(void);
+void biosLoadExec(const char *filename, uint32_t stackBase, uint32_t stackOffset);
+void biosInitCDROM(void);
+void biosSetConf(uint32_t numEvents, uint32_t numThreads, uint32_t stackTop);
+
 /**
  * @brief Blocks for (roughly) the specified number of microseconds. This
  * function will reset hardware timer 2 and use it for timing. Disabling
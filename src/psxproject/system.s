@@ -206,6 +206,60 @@ _fastRebootDummyShell:
 	nop
 	nop
 
+## BIOS API calls
+
+# These are only meant to be used once the BIOS exception handler has been
+# restored using uninstallExceptionHandler(), as both the A(xxh) functions and
+# the critical section syscalls rely on kernel state that is otherwise left
+# untouched by our own handler.
+
+.section .text.biosEnterCriticalSection, "ax", @progbits
+.global biosEnterCriticalSection
+.type biosEnterCriticalSection, @function
+
+biosEnterCriticalSection:
+	li    $a0, 1
+	syscall 0
+	jr    $ra
+	nop
+
+.section .text.biosExitCriticalSection, "ax", @progbits
+.global biosExitCriticalSection
+.type biosExitCriticalSection, @function
+
+biosExitCriticalSection:
+	li    $a0, 2
+	syscall 0
+	jr    $ra
+	nop
+
+.section .text.biosLoadExec, "ax", @progbits
+.global biosLoadExec
+.type biosLoadExec, @function
+
+biosLoadExec:
+	li    $t2, 0xa0
+	jr    $t2
+	li    $t1, 0x51
+
+.section .text.biosInitCDROM, "ax", @progbits
+.global biosInitCDROM
+.type biosInitCDROM, @function
+
+biosInitCDROM:
+	li    $t2, 0xa0
+	jr    $t2
+	li    $t1, 0x71
+
+.section .text.biosSetConf, "ax", @progbits
+.global biosSetConf
+.type biosSetConf, @function
+
+biosSetConf:
+	li    $t2, 0xa0
+	jr    $t2
+	li    $t1, 0x9c
+
 .set IO_BASE, 0xbf801000
 
 .set TIMER2_VALUE,  IO_BASE | 0x120
@@ -0,0 +1,258 @@
+#include "task.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "irq.h"
+#include "system.h"
+#include "timer.h"
+#include "../logging.h"
+
+#if DEBUG_TASK
+#define DEBUG_PRINT(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINT(...) while (0)
+#endif
+
+// Stacks are filled with this pattern when a task is created, so that the
+// amount actually used can be found later on.
+#define STACK_FILL 0x5a5a5a5a
+
+static Task _mainTask = {
+    .name  = "main",
+    .state = TASK_STATE_READY
+};
+
+static Task      *_currentTask = &_mainTask;
+static uint32_t  _lastSwitch   = 0;
+static TaskStats _stats        = { .numTasks = 1 };
+
+static Thread *_getThread(Task *task){
+    // The main thread's state is kept by system.c.
+    return (task == &_mainTask) ? NULL : &task->thread;
+}
+
+static void _taskEntry(void *arg){
+    Task *task = (Task *) arg;
+
+    task->func(task->arg);
+
+    // Threads must not return, so the task is left to wait forever. As it is
+    // done, it will never be scheduled again.
+    task->state = TASK_STATE_DONE;
+
+    for (;;)
+        task_yield();
+}
+
+// Checks whether the task is ready to run, waking it up if what it was waiting
+// for has happened.
+static bool _isReady(Task *task){
+    switch (task->state){
+        case TASK_STATE_READY:
+            return true;
+
+        case TASK_STATE_WAIT_VBLANK:
+            if (irq_getFrameCount() == task->lastFrame)
+                return false;
+            break;
+
+        case TASK_STATE_WAIT_EVENT:
+            if (
+                !task->event->signalled &&
+                !(task->hasDeadline && timer_isDeadlinePassed(task->deadline))
+            )
+                return false;
+            break;
+
+        default:
+            return false;
+    }
+
+    task->state = TASK_STATE_READY;
+    return true;
+}
+
+static void _switchTo(Task *task){
+    if (task == _currentTask)
+        return;
+
+    uint32_t now = timer_getTicks();
+
+    _currentTask->runTicks += now - _lastSwitch;
+    _lastSwitch             = now;
+    _currentTask            = task;
+
+    task->switches++;
+    _stats.switches++;
+
+    // Execution resumes from here once another task switches back.
+    switchThreadImmediate(_getThread(task));
+}
+
+// Switches to the first task ready to run after the current one (which comes
+// last, so that all other tasks get a turn). If no task is ready, spins until
+// one is.
+static void _schedule(void){
+    Task     *current   = _currentTask;
+    uint32_t idleStart = 0;
+    bool     idle      = false;
+
+    for (;;){
+        Task *next     = NULL;
+        int  numReady  = 0;
+        Task *task     = current;
+
+        do {
+            task = task->next ? task->next : &_mainTask;
+
+            if (!_isReady(task))
+                continue;
+            if (!next)
+                next = task;
+
+            numReady++;
+        } while (task != current);
+
+        if (numReady > _stats.maxReady)
+            _stats.maxReady = numReady;
+
+        if (next){
+            if (idle){
+                // Time spent idle is not charged to the current task.
+                uint32_t idleTicks = timer_getTicks() - idleStart;
+
+                _stats.idleTicks += idleTicks;
+                _lastSwitch      += idleTicks;
+            }
+
+            _switchTo(next);
+            return;
+        }
+
+        if (!idle){
+            idle      = true;
+            idleStart = timer_getTicks();
+        }
+
+        irq_runDeferred();
+    }
+}
+
+void task_create(
+    Task *task, const char *name, ArgFunction func, void *arg, void *stack,
+    size_t stackLength
+){
+    uintptr_t bottom = ((uintptr_t) stack + TASK_STACK_ALIGNMENT - 1) & ~(TASK_STACK_ALIGNMENT - 1);
+    uintptr_t top    = ((uintptr_t) stack + stackLength) & ~(TASK_STACK_ALIGNMENT - 1);
+
+    task->next        = NULL;
+    task->name        = name;
+    task->func        = func;
+    task->arg         = arg;
+    task->stack       = (uint32_t *) bottom;
+    task->stackLength = top - bottom;
+    task->state       = TASK_STATE_READY;
+    task->lastFrame   = irq_getFrameCount();
+    task->event       = NULL;
+    task->hasDeadline = false;
+    task->runTicks    = 0;
+    task->switches    = 0;
+
+    for (uint32_t *ptr = task->stack; ptr < (uint32_t *) top; ptr++)
+        *ptr = STACK_FILL;
+
+    initThread(&task->thread, _taskEntry, task, (void *) (top - 8));
+
+    // New tasks are appended to the run queue, so that they are scheduled
+    // after all existing ones.
+    Task *last = &_mainTask;
+
+    while (last->next)
+        last = last->next;
+
+    last->next = task;
+    _stats.numTasks++;
+
+    DEBUG_PRINT("Task %s created, %d byte stack\n", name, task->stackLength);
+}
+
+void task_yield(void){
+    _stats.yields++;
+    _schedule();
+}
+
+void task_sleepUntilVblank(void){
+    Task *task = _currentTask;
+
+    if (irq_getFrameCount() == task->lastFrame){
+        task->state = TASK_STATE_WAIT_VBLANK;
+        _schedule();
+    }
+
+    task->lastFrame = irq_getFrameCount();
+}
+
+bool task_waitForEvent(TaskEvent *event, uint32_t timeout){
+    Task *task = _currentTask;
+
+    if (!event->signalled){
+        task->event       = event;
+        task->hasDeadline = (timeout != 0);
+        task->deadline    = timer_getDeadline(timeout);
+        task->state       = TASK_STATE_WAIT_EVENT;
+
+        _schedule();
+        task->event = NULL;
+    }
+
+    bool signalled    = event->signalled;
+    event->signalled  = false;
+    return signalled;
+}
+
+Task *task_getCurrent(void){
+    return _currentTask;
+}
+
+size_t task_getStackUsage(const Task *task){
+    if (!task->stack)
+        return 0;
+
+    // The stack grows downwards, so the lowest word that was overwritten
+    // marks the deepest point reached.
+    const uint32_t *ptr = task->stack;
+    const uint32_t *end = task->stack + task->stackLength / 4;
+
+    while ((ptr < end) && (*ptr == STACK_FILL))
+        ptr++;
+
+    return (end - ptr) * 4;
+}
+
+void task_getStats(TaskStats *stats){
+    *stats            = _stats;
+    stats->totalTicks = timer_getTicks();
+}
+
+void task_logStats(void){
+#if DEBUG_TASK
+    TaskStats stats;
+    task_getStats(&stats);
+
+    DEBUG_PRINT(
+        "Tasks: %d tasks, %d switches, %d yields, %d%% idle, up to %d ready\n",
+        stats.numTasks, stats.switches, stats.yields,
+        stats.idleTicks / (stats.totalTicks / 100 + 1), stats.maxReady
+    );
+
+    for (const Task *task = &_mainTask; task; task = task->next)
+        DEBUG_PRINT(
+            "  %s: %d switches, %d us run, %d/%d stack bytes used\n",
+            task->name, task->switches,
+            timer_ticksToMicroseconds(task->runTicks),
+            task_getStackUsage(task), task->stackLength
+        );
+#endif
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "system.h"
+
+// Tasks are cooperatively scheduled threads, each with its own stack. A task
+// only gives up the CPU when it calls task_yield() or one of the wait
+// functions below, so code running in a task never needs to lock anything
+// against other tasks as long as it does not wait halfway through an update.
+// Tasks waiting on a device should yield in their wait loop, so that the CPU
+// goes to other tasks (e.g. rendering) rather than being spent spinning.
+//
+// The main thread is a task as well and is always present; it is the only one
+// allowed to return from its entry point (i.e. main()). Scheduling is round
+// robin among all tasks that are ready to run. If none are, the scheduler
+// spins in the task that last yielded, running deferred IRQ work meanwhile.
+#define TASK_STACK_ALIGNMENT 8
+
+typedef enum {
+    TASK_STATE_READY         = 0,
+    TASK_STATE_WAIT_VBLANK   = 1,
+    TASK_STATE_WAIT_EVENT    = 2,
+    TASK_STATE_DONE          = 3
+} TaskState;
+
+// An event is a flag that can be set from anywhere, including IRQ handlers,
+// and is cleared by the task waiting on it.
+typedef struct {
+    volatile bool signalled;
+} TaskEvent;
+
+typedef struct Task {
+    Thread      thread;
+    struct Task *next;
+    const char  *name;
+
+    ArgFunction func;
+    void        *arg;
+
+    uint32_t  *stack;
+    size_t    stackLength;
+    TaskState state;
+
+    uint32_t  lastFrame, deadline;
+    TaskEvent *event;
+    bool      hasDeadline;
+
+    // Statistics
+    uint32_t runTicks, switches;
+} Task;
+
+typedef struct {
+    uint32_t switches, yields;
+    uint32_t idleTicks, totalTicks;
+    uint8_t  numTasks, maxReady;
+} TaskStats;
+
+/**
+ * @brief Creates a task and adds it to the run queue. The task starts running
+ * the next time the current task yields. The entry point may return, after
+ * which the task is done and never scheduled again.
+ *
+ * @param task
+ * @param name Name shown in statistics
+ * @param func Entry point
+ * @param arg Optional argument to be passed to the entry point
+ * @param stack Buffer to use as the task's stack
+ * @param stackLength Length of the stack buffer in bytes
+ */
+void task_create(
+    Task *task, const char *name, ArgFunction func, void *arg, void *stack,
+    size_t stackLength
+);
+
+/**
+ * @brief Gives the CPU to the next task ready to run, if any, and returns once
+ * the calling task is scheduled again. Must not be called from an IRQ handler
+ * or from deferred work.
+ */
+void task_yield(void);
+
+/**
+ * @brief Blocks the calling task until a vblank occurs, running other tasks
+ * meanwhile. As with a flag set by the vblank IRQ, returns immediately if a
+ * vblank has occurred since the last call from the same task.
+ */
+void task_sleepUntilVblank(void);
+
+/**
+ * @brief Blocks the calling task until the event is signalled, running other
+ * tasks meanwhile, then clears the event.
+ *
+ * @param event
+ * @param timeout Time in microseconds after which to give up, 0 to wait
+ * forever
+ * @return False in case of a timeout, true otherwise
+ */
+bool task_waitForEvent(TaskEvent *event, uint32_t timeout);
+
+static inline void task_signal(TaskEvent *event){
+    event->signalled = true;
+}
+
+static inline bool task_isDone(const Task *task){
+    return (task->state == TASK_STATE_DONE);
+}
+
+/**
+ * @brief Returns the task currently running.
+ */
+Task *task_getCurrent(void);
+
+/**
+ * @brief Returns the number of bytes of the task's stack that have been used
+ * at some point, or 0 for the main task (whose stack is not tracked).
+ *
+ * @param task
+ */
+size_t task_getStackUsage(const Task *task);
+
+/**
+ * @brief Returns global scheduler statistics, collected since boot.
+ *
+ * @param stats
+ */
+void task_getStats(TaskStats *stats);
+
+/**
+ * @brief Prints scheduler and per-task statistics if task logging is enabled.
+ */
+void task_logStats(void);
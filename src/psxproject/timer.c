@@ -0,0 +1,43 @@
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ps1/registers.h"
+#include "system.h"
+
+static volatile uint32_t timerOverflows = 0;
+
+void initTimer(void){
+    timerOverflows = 0;
+
+    // Count at sysclk/8 from 0 to 0xffff and raise an IRQ on every overflow.
+    // The IRQ itself is enabled in initIRQ().
+    TIMER_CTRL(2) = 0
+        | TIMER_CTRL_IRQ_ON_OVERFLOW
+        | TIMER_CTRL_IRQ_REPEAT
+        | TIMER_CTRL_PRESCALE;
+    TIMER_VALUE(2) = 0;
+}
+
+void timer_handleInterrupt(void){
+    timerOverflows++;
+}
+
+uint32_t timer_getTicks(void){
+    bool enable = disableInterrupts();
+
+    uint32_t high = timerOverflows;
+    uint16_t low  = TIMER_VALUE(2);
+
+    // If the counter overflowed while interrupts were disabled, the IRQ will
+    // still be pending and the overflow count is one behind. Only correct for
+    // it if the value read has actually wrapped around already.
+    if ((IRQ_STAT & (1 << IRQ_TIMER2)) && (low < 0x8000))
+        high++;
+
+    if (enable)
+        enableInterrupts();
+
+    return (high << 16) | low;
+}
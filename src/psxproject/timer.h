@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timer 2 is clocked from the system clock divided by 8 and left free-running,
+// with the overflow IRQ used to extend it to 32 bits. At ~4.23 MHz the tick
+// count wraps around after roughly 17 minutes.
+#define TIMER_TICKS_PER_SECOND (33868800 / 8)
+
+void initTimer(void);
+void timer_handleInterrupt(void);
+uint32_t timer_getTicks(void);
+
+static inline uint32_t timer_ticksToMicroseconds(uint32_t ticks){
+    // us = ticks * 1000000 / 4233600 = ticks * 625 / 2646, split to avoid
+    // overflowing 32 bits.
+    return ((ticks / 2646) * 625) + (((ticks % 2646) * 625) / 2646);
+}
+
+static inline uint32_t timer_microsecondsToTicks(uint32_t us){
+    return ((us / 625) * 2646) + (((us % 625) * 2646) / 625);
+}
+
+// Deadlines are plain tick counts; comparisons are done on the signed
+// difference so that they keep working when the counter wraps around.
+static inline uint32_t timer_getDeadline(uint32_t us){
+    return timer_getTicks() + timer_microsecondsToTicks(us);
+}
+
+static inline bool timer_isDeadlinePassed(uint32_t deadline){
+    return ((int32_t) (timer_getTicks() - deadline)) >= 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "system_cnf.h"
+
+static bool _isBlank(char ch) {
+	return (ch == ' ') || (ch == '\t');
+}
+
+static bool _isLineEnd(char ch) {
+	return !ch || (ch == '\n') || (ch == '\r');
+}
+
+static bool _matchKey(const char *key, size_t length, const char *name) {
+	for (; length; length--, key++, name++) {
+		char ch = *key;
+
+		if ((ch >= 'a') && (ch <= 'z'))
+			ch -= 'a' - 'A';
+		if (ch != *name)
+			return false;
+	}
+
+	return !(*name);
+}
+
+static bool _parseHex(const char *value, size_t length, uint32_t *output) {
+	if ((length > 2) && (value[0] == '0') && ((value[1] | 0x20) == 'x')) {
+		value  += 2;
+		length -= 2;
+	}
+
+	if (!length || (length > 8))
+		return false;
+
+	uint32_t result = 0;
+
+	for (; length; length--, value++) {
+		char ch = *value;
+
+		if ((ch >= '0') && (ch <= '9'))
+			ch -= '0';
+		else if (((ch | 0x20) >= 'a') && ((ch | 0x20) <= 'f'))
+			ch = (ch | 0x20) - 'a' + 10;
+		else
+			return false;
+
+		result = (result << 4) | ch;
+	}
+
+	*output = result;
+	return true;
+}
+
+static void _parseLine(SystemCNF *config, const char *line, const char *end) {
+	while ((line < end) && _isBlank(*line))
+		line++;
+
+	// Split the line into a key and a value, the latter of which is cut at
+	// the first whitespace character (the BIOS ignores anything after the boot
+	// path).
+	const char *key = line;
+
+	while ((line < end) && (*line != '=') && !_isBlank(*line))
+		line++;
+
+	size_t keyLength = line - key;
+
+	while ((line < end) && _isBlank(*line))
+		line++;
+
+	if ((line == end) || (*line != '=') || !keyLength)
+		return;
+
+	line++;
+
+	while ((line < end) && _isBlank(*line))
+		line++;
+
+	const char *value = line;
+
+	while ((line < end) && !_isBlank(*line))
+		line++;
+
+	size_t valueLength = line - value;
+
+	if (!valueLength)
+		return;
+
+	uint32_t *number;
+	uint8_t  flag;
+
+	if (_matchKey(key, keyLength, "BOOT")) {
+		if (
+			(config->keys & SYSTEM_CNF_HAS_BOOT) ||
+			(valueLength >= SYSTEM_CNF_BOOT_LENGTH)
+		)
+			return;
+
+		memcpy(config->boot, value, valueLength);
+		config->boot[valueLength] = 0;
+		config->keys             |= SYSTEM_CNF_HAS_BOOT;
+		return;
+	} else if (_matchKey(key, keyLength, "TCB")) {
+		number = &config->tcb;
+		flag   = SYSTEM_CNF_HAS_TCB;
+	} else if (_matchKey(key, keyLength, "EVENT")) {
+		number = &config->event;
+		flag   = SYSTEM_CNF_HAS_EVENT;
+	} else if (_matchKey(key, keyLength, "STACK")) {
+		number = &config->stack;
+		flag   = SYSTEM_CNF_HAS_STACK;
+	} else {
+		return;
+	}
+
+	if (!(config->keys & flag) && _parseHex(value, valueLength, number))
+		config->keys |= flag;
+}
+
+void systemCNF_init(SystemCNF *config) {
+	strcpy(config->boot, SYSTEM_CNF_DEFAULT_BOOT);
+
+	config->tcb   = SYSTEM_CNF_DEFAULT_TCB;
+	config->event = SYSTEM_CNF_DEFAULT_EVENT;
+	config->stack = SYSTEM_CNF_DEFAULT_STACK;
+	config->keys  = 0;
+}
+
+bool systemCNF_parse(SystemCNF *config, const char *data, size_t length) {
+	const char *end = data + length;
+
+	while ((data < end) && *data) {
+		const char *lineEnd = data;
+
+		while ((lineEnd < end) && !_isLineEnd(*lineEnd))
+			lineEnd++;
+
+		_parseLine(config, data, lineEnd);
+
+		// Skip the line terminator, which may be either LF or CRLF (or even a
+		// lone CR).
+		data = lineEnd;
+
+		while ((data < end) && ((*data == '\n') || (*data == '\r')))
+			data++;
+	}
+
+	return (config->keys & SYSTEM_CNF_HAS_BOOT) ? true : false;
+}
@@ -0,0 +1,78 @@
+/*
+ * ps1-bare-metal - (C) 2023 spicyjpeg
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYSTEM_CNF_BOOT_LENGTH 128
+#define SYSTEM_CNF_MAX_LENGTH  0x4000
+
+// Defaults used by the BIOS for any key missing from SYSTEM.CNF (or if the
+// file is missing altogether).
+#define SYSTEM_CNF_DEFAULT_BOOT  "cdrom:PSX.EXE;1"
+#define SYSTEM_CNF_DEFAULT_TCB   4
+#define SYSTEM_CNF_DEFAULT_EVENT 16
+#define SYSTEM_CNF_DEFAULT_STACK 0x801fff00
+
+typedef enum {
+	SYSTEM_CNF_HAS_BOOT  = 1 << 0,
+	SYSTEM_CNF_HAS_TCB   = 1 << 1,
+	SYSTEM_CNF_HAS_EVENT = 1 << 2,
+	SYSTEM_CNF_HAS_STACK = 1 << 3
+} SystemCNFKey;
+
+typedef struct {
+	char     boot[SYSTEM_CNF_BOOT_LENGTH];
+	uint32_t tcb, event, stack;
+	uint8_t  keys;
+} SystemCNF;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Fills in the configuration with the BIOS defaults and clears the set
+ * of keys found.
+ *
+ * @param config
+ */
+void systemCNF_init(SystemCNF *config);
+
+/**
+ * @brief Parses the contents of a SYSTEM.CNF file into the given configuration,
+ * which must have been initialized with systemCNF_init(). Lines may end with
+ * either LF or CRLF and whitespace around keys, values and the equals sign is
+ * ignored, as are blank lines, unknown keys and anything following the boot
+ * path. TCB, EVENT and STACK are parsed as hexadecimal, as done by the BIOS.
+ * If a key is present more than once only its first occurrence is used.
+ *
+ * This function has no dependencies other than the C library, so it can be
+ * built and tested on the host (see tests/system_cnf_test.c).
+ *
+ * @param config
+ * @param data
+ * @param length Length of the data; parsing also stops at the first null byte
+ * @return True if a valid BOOT key was found, false otherwise
+ */
+bool systemCNF_parse(SystemCNF *config, const char *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
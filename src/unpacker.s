@@ -0,0 +1,154 @@
+# ps1-bare-metal - (C) 2023 spicyjpeg
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+# REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+# AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+# INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+# LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+# OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+# PERFORMANCE OF THIS SOFTWARE.
+
+.set noreorder
+
+# This is the decompression stub prepended by packExecutable.py to compressed
+# executables. It unpacks an LZ4 block to the original load address of the
+# executable, flushes the instruction cache and jumps to the original entry
+# point, passing through the arguments given by the loader. The stub is fully
+# position-independent (it only uses relative branches and finds its parameters
+# using the return address of a bal instruction), as packExecutable.py places it
+# right after the end of the unpacked executable, whose size is not known when
+# the stub is built. The compressed data is assumed to be valid and is decoded
+# without any bounds checking.
+
+.set entryPoint, $s0
+.set savedArgc,  $s1
+.set savedArgv,  $s2
+
+.set output,     $a0
+.set input,      $a1
+.set inputEnd,   $a2
+
+.set token,      $t0
+.set length,     $t1
+.set value,      $t2
+.set match,      $t3
+.set const15,    $t4
+.set const255,   $t5
+
+.section .text._start, "ax", @progbits
+.global _start
+.type _start, @function
+
+_start:
+	# Use bal to obtain the address of the parameter block, which immediately
+	# follows the branch's delay slot.
+	move  savedArgc, $a0
+	bal   .LloadParams
+	move  savedArgv, $a1
+
+_params:
+	# These are filled in by packExecutable.py, which locates them by searching
+	# for the magic string. The offset of the compressed data is relative to the
+	# beginning of this block.
+	.ascii "UNPK"
+	.word 0 # Entry point
+	.word 0 # Output address
+	.word 0 # Compressed data offset
+	.word 0 # Compressed data length
+
+.LloadParams:
+	lw    entryPoint,  4($ra)
+	lw    output,      8($ra)
+	lw    input,      12($ra)
+	lw    inputEnd,   16($ra)
+	li    const15,    15
+	addu  input,      $ra
+	li    const255,   255
+	addu  inputEnd,   input
+
+.Lsequence:
+	# Each sequence starts with a token byte whose upper nibble holds the number
+	# of literals, extended by additional bytes if it is 15.
+	lbu   token, 0(input)
+	addiu input, 1
+	srl   length, token, 4
+
+	bne   length, const15, .LcopyLiterals
+	nop
+
+.LliteralLength:
+	lbu   value, 0(input)
+	addiu input, 1
+	addu  length, value
+
+	beq   value, const255, .LliteralLength
+	nop
+
+.LcopyLiterals:
+	beqz  length, .LcheckEnd
+	nop
+
+.LliteralLoop:
+	lbu   value, 0(input)
+	addiu input, 1
+	sb    value, 0(output)
+	addiu length, -1
+
+	bnez  length, .LliteralLoop
+	addiu output, 1
+
+.LcheckEnd:
+	# The last sequence in a block only contains literals.
+	sltu  value, input, inputEnd
+	beqz  value, .Ldone
+	nop
+
+	# Read the 16-bit match offset, then the match length from the lower nibble
+	# of the token (plus the minimum match length of 4).
+	lbu   match, 0(input)
+	lbu   value, 1(input)
+	addiu input, 2
+	sll   value, 8
+	or    match, value
+	subu  match, output, match
+
+	andi  length, token, 15
+	bne   length, const15, .LcopyMatch
+	addiu length, 4
+
+.LmatchLength:
+	lbu   value, 0(input)
+	addiu input, 1
+	addu  length, value
+
+	beq   value, const255, .LmatchLength
+	nop
+
+.LcopyMatch:
+	# Matches may overlap the data being written, so they must be copied one
+	# byte at a time.
+	lbu   value, 0(match)
+	addiu match, 1
+	sb    value, 0(output)
+	addiu length, -1
+
+	bnez  length, .LcopyMatch
+	addiu output, 1
+
+	b     .Lsequence
+	nop
+
+.Ldone:
+	# Flush the instruction cache using the BIOS FlushCache() function (A(44h)),
+	# then jump to the unpacked executable's entry point.
+	li    $t2, 0xa0
+	jalr  $t2
+	li    $t1, 0x44
+
+	move  $a0, savedArgc
+	jr    entryPoint
+	move  $a1, savedArgv
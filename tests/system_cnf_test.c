@@ -0,0 +1,107 @@
+/*
+ * Host test for the SYSTEM.CNF parser. Returns a non-zero exit code if any
+ * check fails.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "system_cnf.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static bool _parse(SystemCNF *config, const char *data) {
+	systemCNF_init(config);
+	return systemCNF_parse(config, data, strlen(data));
+}
+
+static void testLF(void) {
+	SystemCNF config;
+
+	CHECK(_parse(
+		&config,
+		"BOOT = cdrom:\\SLUS_000.01;1\nTCB = 4\nEVENT = 10\nSTACK = 801FFF00\n"
+	));
+	CHECK(!strcmp(config.boot, "cdrom:\\SLUS_000.01;1"));
+	CHECK(config.tcb == 4);
+	CHECK(config.event == 0x10);
+	CHECK(config.stack == 0x801fff00);
+	CHECK(config.keys == (
+		SYSTEM_CNF_HAS_BOOT | SYSTEM_CNF_HAS_TCB | SYSTEM_CNF_HAS_EVENT |
+		SYSTEM_CNF_HAS_STACK
+	));
+}
+
+static void testCRLF(void) {
+	SystemCNF config;
+
+	CHECK(_parse(&config, "BOOT=cdrom:\\GAME.EXE;1\r\nTCB=8\r\n"));
+	CHECK(!strcmp(config.boot, "cdrom:\\GAME.EXE;1"));
+	CHECK(config.tcb == 8);
+}
+
+static void testLeadingBlankLine(void) {
+	SystemCNF config;
+
+	CHECK(_parse(&config, "\r\n\nBOOT = cdrom:\\GAME.EXE;1\n"));
+	CHECK(!strcmp(config.boot, "cdrom:\\GAME.EXE;1"));
+}
+
+static void testBootOnLaterLine(void) {
+	SystemCNF config;
+
+	CHECK(_parse(&config, "TCB = 4\nEVENT = 10\nBOOT = cdrom:\\GAME.EXE;1 arg\n"));
+	CHECK(!strcmp(config.boot, "cdrom:\\GAME.EXE;1"));
+	CHECK(config.event == 0x10);
+}
+
+static void testLowercaseKeys(void) {
+	SystemCNF config;
+
+	CHECK(_parse(&config, "boot = cdrom:\\GAME.EXE;1\nStack = 0x801ffff0\n"));
+	CHECK(!strcmp(config.boot, "cdrom:\\GAME.EXE;1"));
+	CHECK(config.stack == 0x801ffff0);
+}
+
+static void testBadHex(void) {
+	SystemCNF config;
+
+	// Invalid values are ignored and the defaults kept.
+	CHECK(_parse(&config, "BOOT = cdrom:\\GAME.EXE;1\nTCB = 4G\nSTACK = 123456789\n"));
+	CHECK(config.tcb == SYSTEM_CNF_DEFAULT_TCB);
+	CHECK(config.stack == SYSTEM_CNF_DEFAULT_STACK);
+	CHECK(!(config.keys & (SYSTEM_CNF_HAS_TCB | SYSTEM_CNF_HAS_STACK)));
+}
+
+static void testMissingBoot(void) {
+	SystemCNF config;
+
+	CHECK(!_parse(&config, "TCB = 4\n"));
+	CHECK(!strcmp(config.boot, SYSTEM_CNF_DEFAULT_BOOT));
+}
+
+int main(void) {
+	testLF();
+	testCRLF();
+	testLeadingBlankLine();
+	testBootOnLaterLine();
+	testLowercaseKeys();
+	testBadHex();
+	testMissingBoot();
+
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	else
+		printf("All checks passed\n");
+
+	return failures ? 1 : 0;
+}